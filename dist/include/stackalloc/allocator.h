@@ -0,0 +1,58 @@
+#pragma once
+
+#include "allocate.h"
+#include <limits>
+#include <new>
+
+namespace stackalloc {
+
+// An adapter satisfying the Allocator requirements, so that standard
+// containers can allocate from an arena.
+// Memory comes from the arena that was current when the allocator was
+// created (or an explicit arena). deallocate releases in LIFO order where it
+// can; memory released out of order, such as the old buffer of a growing
+// vector or a node erased from a map, is reclaimed once everything allocated
+// after it has been released. Containers using it should be destroyed in the
+// scope they were created in
+template <typename T> class allocator {
+  detail::arena_state *a;
+
+  template <typename U> friend class allocator;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  // Allocates from the current arena
+  allocator() noexcept : a(detail::current_arena()) {}
+  // Allocates from an explicit arena
+  explicit allocator(arena &ar) noexcept : a(detail::get_state(ar)) {}
+  template <typename U>
+  allocator(const allocator<U> &other) noexcept : a(other.a) {}
+
+  T *allocate(std::size_t n) {
+    // Arena allocations are only ever aligned this much
+    static_assert(alignof(T) <= stack_alignment,
+                  "allocator can't over-align beyond stack_alignment");
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+      throw std::bad_array_new_length();
+    return reinterpret_cast<T *>(detail::allocate(a, sizeof(T) * n));
+  }
+
+  void deallocate(T *p, std::size_t n) noexcept {
+    detail::deallocate(a, reinterpret_cast<char *>(p), sizeof(T) * n);
+  }
+
+  // Allocators are equal when they share an arena
+  template <typename U> bool operator==(const allocator<U> &other) const {
+    return a == other.a;
+  }
+  template <typename U> bool operator!=(const allocator<U> &other) const {
+    return a != other.a;
+  }
+};
+
+} // namespace stackalloc
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "allocate.h"
+#include <memory>
+
+namespace stackalloc {
+
+// A scoped checkpoint in an arena. When the frame goes out of scope,
+// everything allocated from the arena since it was created is released at
+// once, at a cost independent of the number of allocations.
+// Memory from frame::allocate carries no per-allocation bookkeeping, and is
+// never released individually. Objects created with make or make_array have
+// their destructors run, in reverse order of construction, when the frame
+// exits. Any stack_ptrs created inside the frame must be destroyed before it is
+class frame {
+  // A node in the list of objects to destroy on exit, stored in the arena
+  // alongside the objects themselves
+  struct finalizer {
+    void (*destroy)(void *, std::size_t);
+    void *p;
+    std::size_t n;
+    finalizer *next;
+  };
+
+  detail::arena_state *state;
+  detail::marker m;
+  // The most recently registered finalizer
+  finalizer *finalizers = nullptr;
+
+  template <typename T> static void destroy(void *p, std::size_t n) {
+    detail::destroy_backward(static_cast<T *>(p), static_cast<T *>(p) + n);
+  }
+
+  // Registers objects for destruction on exit. The node is allocated before
+  // the objects are constructed so that registering them cannot throw
+  template <typename T> finalizer *reserve_finalizer() {
+    if constexpr (std::is_trivially_destructible_v<T>)
+      return nullptr;
+    else
+      return static_cast<finalizer *>(
+          allocate(sizeof(finalizer), alignof(finalizer)));
+  }
+  template <typename T>
+  void register_finalizer(finalizer *f, T *p, std::size_t n) {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      *f = {&destroy<T>, p, n, finalizers};
+      finalizers = f;
+    }
+  }
+
+  explicit frame(detail::arena_state *state)
+      : state(state), m(detail::mark(state)) {}
+
+public:
+  // Creates a frame in the current arena
+  frame() : frame(detail::current_arena()) {}
+  // Creates a frame in an explicit arena
+  explicit frame(arena &a) : frame(detail::get_state(a)) {}
+  frame(const frame &) = delete;
+  frame &operator=(const frame &) = delete;
+  ~frame() {
+    for (auto f = finalizers; f; f = f->next)
+      f->destroy(f->p, f->n);
+    detail::release(state, m);
+  }
+
+  // Allocates uninitialized memory that lives until the frame exits
+  void *allocate(std::size_t size,
+                 std::size_t alignment = alignof(std::max_align_t)) {
+    return detail::allocate_bytes(state, size, alignment);
+  }
+
+  // Constructs an object that lives until the frame exits
+  template <typename T, class... Args> T *make(Args &&... args) {
+    auto f = reserve_finalizer<T>();
+    auto p =
+        new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    register_finalizer(f, p, 1);
+    return p;
+  }
+
+  // Constructs an array of n default-initialized elements that lives until
+  // the frame exits
+  template <typename T> T *make_array(std::size_t n) {
+    auto f = reserve_finalizer<T>();
+    auto p = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+    std::uninitialized_default_construct_n(p, n);
+    register_finalizer(f, p, n);
+    return p;
+  }
+};
+
+} // namespace stackalloc
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "allocate.h"
+#include "stack_span.h"
+#include <tuple>
+
+namespace stackalloc {
+
+template <typename... Ts> class stack_soa;
+
+namespace detail {
+template <typename... Ts>
+stack_soa<Ts...> make_soa(arena_state *state, std::size_t size);
+} // namespace detail
+
+// A struct of arrays: size elements of each of Ts, stored column by column in
+// a single allocation. Every column starts on a cache line and is padded to a
+// whole number of them, so columns can be processed with aligned vector loads
+// and never share a line.
+// Like stack_ptr, it deallocates itself at the end of its scope and can be
+// moved out of the function that made it, but not copied or assigned
+template <typename... Ts> class stack_soa {
+  static_assert(sizeof...(Ts) > 0, "stack_soa needs at least one column");
+  static_assert((... && (std::is_object_v<Ts> && !std::is_array_v<Ts> &&
+                         !std::is_abstract_v<Ts>)),
+                "stack_soa columns must hold complete object types");
+
+public:
+  template <std::size_t I>
+  using column_type = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+private:
+  // The first element of each column
+  std::tuple<Ts *...> columns;
+
+  // The number of elements in each column
+  std::size_t s;
+
+  // The arena the allocation belongs to
+  detail::arena_state *a;
+
+  template <typename... Us>
+  friend stack_soa<Us...> detail::make_soa(detail::arena_state *, std::size_t);
+
+  // The bytes taken by a column, padded to whole cache lines
+  template <typename T> static std::size_t column_size(std::size_t size) {
+    auto line = detail::allocation_alignment();
+    return (sizeof(T) * size + line - 1) / line * line;
+  }
+
+  static std::size_t allocation_size(std::size_t size) {
+    return (... + column_size<Ts>(size));
+  }
+
+  // Default-initializes the columns from I on, starting at p, and destroys
+  // the ones already constructed if one of them throws
+  template <std::size_t I> void construct(char *p) {
+    if constexpr (I < sizeof...(Ts)) {
+      using T = column_type<I>;
+      auto column = reinterpret_cast<T *>(p);
+      detail::default_initializer{}(column, s);
+      std::get<I>(columns) = column;
+      try {
+        construct<I + 1>(p + column_size<T>(s));
+      } catch (...) {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+          detail::destroy_backward(column, column + s);
+        throw;
+      }
+    }
+  }
+
+  template <std::size_t I> void destroy() {
+    if constexpr (I < sizeof...(Ts)) {
+      destroy<I + 1>();
+      if constexpr (!std::is_trivially_destructible_v<column_type<I>>)
+        detail::destroy_backward(std::get<I>(columns),
+                                 std::get<I>(columns) + s);
+    }
+  }
+
+  stack_soa(detail::arena_state *a, std::size_t s) : columns(), s(s), a(a) {
+    auto bytes = allocation_size(s);
+    auto p = detail::allocate(a, bytes);
+    detail::initialize(a, p, bytes, [&] { construct<0>(p); });
+  }
+
+public:
+  // Takes over the allocation, leaving other empty
+  stack_soa(stack_soa &&other) noexcept
+      : columns(std::exchange(other.columns, {})),
+        s(std::exchange(other.s, 0)), a(other.a) {}
+  stack_soa &operator=(stack_soa &&other) = delete;
+  stack_soa(const stack_soa &other) = delete;
+  stack_soa &operator=(const stack_soa &other) = delete;
+
+  ~stack_soa() {
+    auto p = reinterpret_cast<char *>(std::get<0>(columns));
+    if (!p)
+      return;
+    destroy<0>();
+    detail::deallocate(a, p, allocation_size(s));
+  }
+
+  // Returns the number of elements in each column
+  std::size_t size() const noexcept { return s; }
+
+  // Returns a view of column I
+  template <std::size_t I>
+  stack_span<column_type<I>, stack_alignment> get() const noexcept {
+    return {std::get<I>(columns), s};
+  }
+};
+
+namespace detail {
+template <typename... Ts>
+stack_soa<Ts...> make_soa(arena_state *state, std::size_t size) {
+  return {state, size};
+}
+} // namespace detail
+
+// Allocates size default-initialized elements of each of Ts, as cache line
+// aligned columns in one allocation. Trivial types are left uninitialized
+template <typename... Ts> stack_soa<Ts...> make_stack_soa(std::size_t size) {
+  return detail::make_soa<Ts...>(detail::current_arena(), size);
+}
+// Allocates from an explicit arena rather than the current one
+template <typename... Ts>
+stack_soa<Ts...> make_stack_soa(arena &a, std::size_t size) {
+  return detail::make_soa<Ts...>(detail::get_state(a), size);
+}
+
+} // namespace stackalloc
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace stackalloc {
+
+// Tells the compiler that p is aligned to N bytes, following
+// std::assume_aligned (which is C++20)
+template <std::size_t N, typename T>
+[[nodiscard]] constexpr T *assume_aligned(T *p) {
+  static_assert(N && (N & (N - 1)) == 0, "alignment must be a power of two");
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
+  // Constant evaluation has no use for the hint
+  if (!__builtin_is_constant_evaluated())
+    return static_cast<T *>(__builtin_assume_aligned(p, N));
+#endif
+  return p;
+}
+
+// A non-owning view of a contiguous run of elements in an arena, following
+// std::span (which is C++20). The first element is known to be aligned to
+// Align bytes, so loops over the view can use aligned vector loads
+template <typename T, std::size_t Align = alignof(T)> class stack_span {
+  static_assert(Align >= alignof(T) && (Align & (Align - 1)) == 0,
+                "Align must be a power of two no weaker than alignof(T)");
+
+public:
+  using element_type = T;
+  using value_type = std::remove_cv_t<T>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T *;
+  using reference = T &;
+  using iterator = T *;
+  static constexpr std::size_t alignment = Align;
+
+private:
+  pointer p;
+  size_type s;
+
+public:
+  constexpr stack_span() noexcept : p(nullptr), s(0) {}
+  // Views s elements starting at p, which must be aligned to Align
+  constexpr stack_span(pointer p, size_type s) noexcept : p(p), s(s) {}
+  // Views mutable elements as const, or drops to a weaker alignment
+  template <typename U, std::size_t UAlign,
+            typename = std::enable_if_t<
+                (std::is_same_v<U, T> || std::is_same_v<const U, T>) &&
+                UAlign % Align == 0 &&
+                (UAlign != Align || !std::is_same_v<U, T>)>>
+  constexpr stack_span(const stack_span<U, UAlign> &other) noexcept
+      : p(other.data()), s(other.size()) {}
+
+  // Observers:
+  constexpr pointer data() const noexcept {
+    return stackalloc::assume_aligned<Align>(p);
+  }
+  constexpr size_type size() const noexcept { return s; }
+  constexpr size_type size_bytes() const noexcept { return sizeof(T) * s; }
+  constexpr bool empty() const noexcept { return s == 0; }
+
+  // Element access:
+  constexpr reference operator[](size_type i) const { return data()[i]; }
+  constexpr reference front() const { return data()[0]; }
+  constexpr reference back() const { return data()[s - 1]; }
+
+  // Iterators:
+  constexpr iterator begin() const noexcept { return data(); }
+  constexpr iterator end() const noexcept { return data() + s; }
+
+  // Subviews. Only a prefix keeps the alignment
+  constexpr stack_span first(size_type n) const { return {p, n}; }
+  constexpr stack_span<T> last(size_type n) const { return {p + s - n, n}; }
+  constexpr stack_span<T> subspan(size_type offset, size_type n) const {
+    return {p + offset, n};
+  }
+};
+
+} // namespace stackalloc
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "allocate.h"
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+
+namespace stackalloc {
+
+// A growable array backed by an arena, with an interface following
+// std::vector.
+// While the vector is the most recent allocation in its arena it grows in
+// place by moving the arena's top. Once something else has been allocated
+// after it, growing relocates it to the top; the old storage is reclaimed when
+// everything allocated after it has been released.
+// A stack_vector should be destroyed in the scope it was created in. Unlike
+// stack_ptr it can't be moved out of that scope either: it is meant to stay on
+// top of the arena and grow in place, which a vector handed back to a caller
+// would stop doing as soon as the caller allocated
+template <typename T> class stack_vector {
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T &;
+  using const_reference = const T &;
+  using pointer = T *;
+  using const_pointer = const T *;
+  using iterator = T *;
+  using const_iterator = const T *;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+  // The arena the storage comes from
+  detail::arena_state *a;
+  pointer p = nullptr;
+  size_type s = 0;
+  size_type cap = 0;
+
+  explicit stack_vector(detail::arena_state *a) : a(a) {}
+
+  // Makes room for at least new_cap elements, growing geometrically
+  void grow(size_type new_cap) {
+    reserve(std::max(new_cap, cap * 2));
+  }
+
+public:
+  // Creates an empty vector in the current arena
+  stack_vector() : stack_vector(detail::current_arena()) {}
+  // Creates an empty vector in an explicit arena
+  explicit stack_vector(arena &ar) : stack_vector(detail::get_state(ar)) {}
+  stack_vector(std::initializer_list<T> init) : stack_vector() {
+    reserve(init.size());
+    for (auto &x : init)
+      emplace_back(x);
+  }
+  stack_vector(const stack_vector &) = delete;
+  stack_vector &operator=(const stack_vector &) = delete;
+  stack_vector(stack_vector &&) = delete;
+  stack_vector &operator=(stack_vector &&) = delete;
+
+  ~stack_vector() {
+    clear();
+    detail::deallocate(a, reinterpret_cast<char *>(p), sizeof(T) * cap);
+  }
+
+  // Element access:
+  reference operator[](size_type i) { return p[i]; }
+  const_reference operator[](size_type i) const { return p[i]; }
+  reference front() { return p[0]; }
+  const_reference front() const { return p[0]; }
+  reference back() { return p[s - 1]; }
+  const_reference back() const { return p[s - 1]; }
+  pointer data() noexcept { return p; }
+  const_pointer data() const noexcept { return p; }
+
+  // Iterators:
+  iterator begin() noexcept { return p; }
+  const_iterator begin() const noexcept { return p; }
+  const_iterator cbegin() const noexcept { return p; }
+  iterator end() noexcept { return p + s; }
+  const_iterator end() const noexcept { return p + s; }
+  const_iterator cend() const noexcept { return p + s; }
+  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  // Capacity:
+  bool empty() const noexcept { return s == 0; }
+  size_type size() const noexcept { return s; }
+  size_type capacity() const noexcept { return cap; }
+
+  void reserve(size_type new_cap) {
+    if (new_cap <= cap)
+      return;
+    if (p && detail::try_resize(a, reinterpret_cast<char *>(p),
+                                sizeof(T) * cap, sizeof(T) * new_cap)) {
+      cap = new_cap;
+      return;
+    }
+    auto new_p =
+        reinterpret_cast<pointer>(detail::allocate(a, sizeof(T) * new_cap));
+    try {
+      detail::relocate(p, s, new_p);
+    } catch (...) {
+      detail::deallocate(a, reinterpret_cast<char *>(new_p),
+                         sizeof(T) * new_cap);
+      throw;
+    }
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      detail::destroy_backward(p, p + s);
+    detail::deallocate(a, reinterpret_cast<char *>(p), sizeof(T) * cap);
+    p = new_p;
+    cap = new_cap;
+  }
+
+  // Releases unused capacity
+  void shrink_to_fit() {
+    if (cap > s) {
+      detail::try_resize(a, reinterpret_cast<char *>(p), sizeof(T) * cap,
+                         sizeof(T) * s);
+      cap = s;
+    }
+  }
+
+  // Modifiers:
+  void clear() noexcept {
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      detail::destroy_backward(p, p + s);
+    s = 0;
+  }
+
+  void push_back(const T &value) { emplace_back(value); }
+  void push_back(T &&value) { emplace_back(std::move(value)); }
+
+  template <class... Args> reference emplace_back(Args &&... args) {
+    if (s == cap) {
+      // Construct first, in case args refer to an element that is relocated
+      T value(std::forward<Args>(args)...);
+      grow(s + 1);
+      new (p + s) T(std::move(value));
+    } else {
+      new (p + s) T(std::forward<Args>(args)...);
+    }
+    return p[s++];
+  }
+
+  void pop_back() {
+    --s;
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      p[s].~T();
+  }
+
+  // Resizes to count elements, value-initializing any new ones
+  void resize(size_type count) {
+    if (count < s) {
+      detail::destroy_backward(p + count, p + s);
+    } else if (count > s) {
+      if (count > cap)
+        grow(count);
+      std::uninitialized_value_construct(p + s, p + count);
+    }
+    s = count;
+  }
+  void resize(size_type count, const value_type &value) {
+    if (count < s) {
+      detail::destroy_backward(p + count, p + s);
+    } else if (count > s) {
+      if (count > cap) {
+        // value may be an element that is about to be relocated
+        T copy(value);
+        grow(count);
+        std::uninitialized_fill(p + s, p + count, copy);
+      } else {
+        std::uninitialized_fill(p + s, p + count, value);
+      }
+    }
+    s = count;
+  }
+};
+
+} // namespace stackalloc
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "allocate.h"
+#include "stack_span.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace stackalloc {
+
+// Kernels over aligned views. The views promise the alignment of their first
+// element to the compiler, so these loops are vectorized with aligned loads
+// and stores and without a peeled prologue. Reductions keep one accumulator
+// per vector lane, so they vectorize without reassociation flags; like
+// std::reduce, they assume the operation is associative and commutative
+
+namespace detail {
+// The number of elements in an aligned chunk, and so the number of
+// independent accumulators a reduction keeps
+template <typename T, std::size_t Align>
+constexpr std::size_t lanes = Align > sizeof(T) ? Align / sizeof(T) : 1;
+
+// Combines the elements of a non-empty view with op, one lane at a time
+template <typename T, std::size_t Align, typename U, typename Op>
+U reduce_lanes(stack_span<T, Align> s, U init, Op op) {
+  constexpr auto n_lanes = lanes<T, Align>;
+  auto p = s.data();
+  auto n = s.size();
+  std::size_t i = 0;
+  if (n >= n_lanes) {
+    U acc[n_lanes];
+    for (std::size_t j = 0; j < n_lanes; ++j)
+      acc[j] = p[j];
+    for (i = n_lanes; i + n_lanes <= n; i += n_lanes)
+      for (std::size_t j = 0; j < n_lanes; ++j)
+        acc[j] = op(acc[j], p[i + j]);
+    for (std::size_t j = 0; j < n_lanes; ++j)
+      init = op(init, acc[j]);
+  }
+  for (; i < n; ++i)
+    init = op(init, p[i]);
+  return init;
+}
+} // namespace detail
+
+// Assigns value to every element
+template <typename T, std::size_t Align>
+void fill(stack_span<T, Align> s, const std::remove_cv_t<T> &value) {
+  auto p = s.data();
+  for (std::size_t i = 0; i < s.size(); ++i)
+    p[i] = value;
+}
+
+// Copies the elements of from to the start of to, which must be at least as
+// large, and returns the view of the copied elements
+template <typename T, std::size_t FromAlign, typename U, std::size_t ToAlign>
+stack_span<U, ToAlign> copy(stack_span<T, FromAlign> from,
+                            stack_span<U, ToAlign> to) {
+  auto p = from.data();
+  auto q = to.data();
+  if constexpr (std::is_same_v<std::remove_cv_t<T>, U> &&
+                std::is_trivially_copyable_v<U>) {
+    // An empty view may have no storage
+    if (!from.empty())
+      std::memcpy(q, p, from.size_bytes());
+  } else {
+    for (std::size_t i = 0; i < from.size(); ++i)
+      q[i] = p[i];
+  }
+  return to.first(from.size());
+}
+
+// Like copy, but large copies of trivially copyable elements use
+// non-temporal stores, so that data which is processed once doesn't evict the
+// working set. to must start on a cache line, as stack arrays do
+template <typename T, std::size_t FromAlign, typename U, std::size_t ToAlign>
+stack_span<U, ToAlign> copy_streaming(stack_span<T, FromAlign> from,
+                                      stack_span<U, ToAlign> to) {
+  static_assert(ToAlign % stack_alignment == 0,
+                "streaming copies need a destination aligned like the stack");
+  if constexpr (std::is_same_v<std::remove_cv_t<T>, U> &&
+                std::is_trivially_copyable_v<U>) {
+    if (!from.empty())
+      detail::copy_streaming(reinterpret_cast<char *>(to.data()),
+                             reinterpret_cast<const char *>(from.data()),
+                             from.size_bytes());
+    return to.first(from.size());
+  } else {
+    return copy(from, to);
+  }
+}
+
+// Stores f(x) for every element x of from at the same position in to, which
+// must be at least as large
+template <typename T, std::size_t FromAlign, typename U, std::size_t ToAlign,
+          typename F>
+stack_span<U, ToAlign> transform(stack_span<T, FromAlign> from,
+                                 stack_span<U, ToAlign> to, F f) {
+  auto p = from.data();
+  auto q = to.data();
+  for (std::size_t i = 0; i < from.size(); ++i)
+    q[i] = f(p[i]);
+  return to.first(from.size());
+}
+
+// Stores f(x, y) for every pair of elements of a and b at the same position
+// in to. b and to must be at least as large as a
+template <typename T, std::size_t AAlign, typename U, std::size_t BAlign,
+          typename V, std::size_t ToAlign, typename F>
+stack_span<V, ToAlign> transform(stack_span<T, AAlign> a,
+                                 stack_span<U, BAlign> b,
+                                 stack_span<V, ToAlign> to, F f) {
+  auto p = a.data();
+  auto q = b.data();
+  auto r = to.data();
+  for (std::size_t i = 0; i < a.size(); ++i)
+    r[i] = f(p[i], q[i]);
+  return to.first(a.size());
+}
+
+// Combines init and every element with op, in unspecified order
+template <typename T, std::size_t Align, typename U, typename Op>
+U reduce(stack_span<T, Align> s, U init, Op op) {
+  return detail::reduce_lanes(s, std::move(init), op);
+}
+// Sums the elements
+template <typename T, std::size_t Align>
+std::remove_cv_t<T> reduce(stack_span<T, Align> s) {
+  return reduce(s, std::remove_cv_t<T>(),
+                [](const auto &x, const auto &y) { return x + y; });
+}
+
+// Returns the smallest element of a non-empty view
+template <typename T, std::size_t Align>
+std::remove_cv_t<T> min(stack_span<T, Align> s) {
+  return detail::reduce_lanes(
+      s, std::remove_cv_t<T>(s[0]),
+      [](const auto &x, const auto &y) { return y < x ? y : x; });
+}
+// Returns the largest element of a non-empty view
+template <typename T, std::size_t Align>
+std::remove_cv_t<T> max(stack_span<T, Align> s) {
+  return detail::reduce_lanes(
+      s, std::remove_cv_t<T>(s[0]),
+      [](const auto &x, const auto &y) { return x < y ? y : x; });
+}
+
+} // namespace stackalloc
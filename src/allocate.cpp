@@ -1,8 +1,25 @@
 #include "allocate.h"
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <new>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define STACKALLOC_HAS_MMAP 1
+#endif
 
 namespace {
 
@@ -20,10 +37,124 @@ constexpr std::size_t cache_line_size = 64;
 constexpr std::size_t cache_line_size = alignof(std::max_align_t);
 #endif
 
+// Headers promise this much alignment to the compiler
+static_assert(cache_line_size % stackalloc::stack_alignment == 0,
+              "allocations must be aligned to stack_alignment");
+
 constexpr std::size_t round_to_cache_lines(std::size_t s) {
   return (s + cache_line_size - 1) / cache_line_size * cache_line_size;
 }
 
+// Fills and copies at least as large as the L2 cache bypass the cache
+// entirely, since they would evict more than they could leave behind. Falls
+// back to a common L2 size if none is provided
+#if defined(KNOWN_L2_CACHE_SIZE) && KNOWN_L2_CACHE_SIZE
+constexpr std::size_t streaming_threshold = KNOWN_L2_CACHE_SIZE;
+#else
+constexpr std::size_t streaming_threshold = std::size_t(1) << 20;
+#endif
+
+// Parallel initialization gives every thread at least this much, so that
+// handing out chunks is cheap compared to filling them
+constexpr std::size_t parallel_chunk_size = std::size_t(1) << 20;
+// Chunks of parallel initialization start on pages of this size
+constexpr std::size_t page_size = 4096;
+
+// Blocks at least this large are mapped directly from the kernel, so that
+// their memory starts out zeroed
+constexpr std::size_t mmap_threshold = std::size_t(256) << 10;
+
+// Writes copies of a cache line over the first s bytes of p, rounded down to
+// whole cache lines. p must be cache line aligned
+void store_lines(char *p, std::size_t s, const char *line) {
+  auto end = p + s / cache_line_size * cache_line_size;
+#if defined(__AVX__)
+  if (s >= streaming_threshold) {
+    __m256i v[cache_line_size / sizeof(__m256i)];
+    for (std::size_t j = 0; j < std::size(v); ++j)
+      v[j] = _mm256_load_si256(reinterpret_cast<const __m256i *>(line) + j);
+    for (; p != end; p += cache_line_size)
+      for (std::size_t j = 0; j < std::size(v); ++j)
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(p) + j, v[j]);
+    _mm_sfence();
+    return;
+  }
+#elif defined(__SSE2__)
+  if (s >= streaming_threshold) {
+    __m128i v[cache_line_size / sizeof(__m128i)];
+    for (std::size_t j = 0; j < std::size(v); ++j)
+      v[j] = _mm_load_si128(reinterpret_cast<const __m128i *>(line) + j);
+    for (; p != end; p += cache_line_size)
+      for (std::size_t j = 0; j < std::size(v); ++j)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(p) + j, v[j]);
+    _mm_sfence();
+    return;
+  }
+#endif
+  // Fixed size copies compile down to the widest vector stores available
+  for (; p != end; p += cache_line_size)
+    std::memcpy(p, line, cache_line_size);
+}
+
+// Copies the first s bytes of from to p with non-temporal stores, rounded down
+// to whole cache lines. p must be cache line aligned, from needn't be
+void stream_lines(char *p, const char *from, std::size_t s) {
+  auto end = p + s / cache_line_size * cache_line_size;
+#if defined(__AVX__)
+  for (; p != end; p += cache_line_size, from += cache_line_size)
+    for (std::size_t j = 0; j < cache_line_size / sizeof(__m256i); ++j)
+      _mm256_stream_si256(
+          reinterpret_cast<__m256i *>(p) + j,
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(from) + j));
+  _mm_sfence();
+#elif defined(__SSE2__)
+  for (; p != end; p += cache_line_size, from += cache_line_size)
+    for (std::size_t j = 0; j < cache_line_size / sizeof(__m128i); ++j)
+      _mm_stream_si128(
+          reinterpret_cast<__m128i *>(p) + j,
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(from) + j));
+  _mm_sfence();
+#else
+  std::memcpy(p, from, end - p);
+#endif
+}
+
+// Sets (or clears) bits [first, last) of a bitmap
+void update_bits(std::uint64_t *bits, std::size_t first, std::size_t last,
+                 bool set) {
+  while (first < last) {
+    auto bit = first % 64;
+    auto n = std::min<std::size_t>(64 - bit, last - first);
+    auto mask = (n == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1)
+                << bit;
+    if (set)
+      bits[first / 64] |= mask;
+    else
+      bits[first / 64] &= ~mask;
+    first += n;
+  }
+}
+
+// Returns the start of the run of set bits that ends just before last
+std::size_t run_start(const std::uint64_t *bits, std::size_t last) {
+  while (last) {
+    auto bit = (last - 1) % 64;
+    // Line up bit with the top of the word, and count the ones from there
+    auto word = ~(bits[(last - 1) / 64] << (63 - bit));
+    std::size_t ones = 0;
+#if defined(__GNUC__)
+    ones = word ? __builtin_clzll(word) : 64;
+#else
+    for (; ones < 64 && !(word >> (63 - ones) & 1); ++ones)
+      ;
+#endif
+    if (ones <= bit)
+      return last - ones;
+    last -= bit + 1;
+  }
+  return 0;
+}
+
 struct block {
 private:
   struct block_info {
@@ -35,22 +166,73 @@ private:
     std::size_t size;
     // The next offset within our own block that can be allocated
     char *current_offset;
+    // The size of the mapping if the block was mapped from the kernel, or 0 if
+    // it came from operator new
+    std::size_t mapped_size;
+    // Everything from here to the end of the block has never been handed out,
+    // and is known to be zero
+    char *clean_offset;
+    // The number of open markers taken in this block, which keep it in the
+    // chain until they are released
+    std::size_t marks;
+    // One bit per cache line of the block, set for lines that were released
+    // out of LIFO order and are waiting for the allocations above them. Kept
+    // after the data, so that recording a release never allocates
+    std::uint64_t *deferred_lines;
   };
 
   static constexpr std::size_t info_offset =
       round_to_cache_lines(sizeof(block_info));
   char *aligned_alloc;
 
-  block_info &get_info() {
-    return *reinterpret_cast<block_info *>(aligned_alloc - info_offset);
+  static block_info &get_info(char *p) {
+    return *reinterpret_cast<block_info *>(p - info_offset);
   }
 
+  block_info &get_info() { return get_info(aligned_alloc); }
+
   const block_info &get_info() const {
     return *reinterpret_cast<const block_info *>(aligned_alloc - info_offset);
   }
 
   block(char *p) : aligned_alloc(p) {}
 
+  // The bytes of bitmap needed for a block of the given size, with room for
+  // the extra cache line the alignment might add
+  static std::size_t bitmap_size(std::size_t size) {
+    return (size / cache_line_size + 2 + 63) / 64 * sizeof(std::uint64_t);
+  }
+
+  // Returns the index of the cache line holding p in the block starting at data
+  static std::size_t line_of(const char *data, const char *p) {
+    return std::size_t(p - data) / cache_line_size;
+  }
+
+  static void *acquire(std::size_t size, std::size_t &mapped_size) {
+#if defined(STACKALLOC_HAS_MMAP)
+    if (size >= mmap_threshold) {
+      auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+        throw std::bad_alloc();
+      mapped_size = size;
+      return p;
+    }
+#endif
+    mapped_size = 0;
+    return ::operator new(size);
+  }
+
+  static void release(void *p, std::size_t mapped_size) {
+#if defined(STACKALLOC_HAS_MMAP)
+    if (mapped_size) {
+      munmap(p, mapped_size);
+      return;
+    }
+#endif
+    ::operator delete(p);
+  }
+
 public:
   block() : aligned_alloc(nullptr) {}
   block(block &&b) : aligned_alloc(std::exchange(b.aligned_alloc, nullptr)) {}
@@ -58,65 +240,174 @@ public:
   // Constructs a block of a given size, with a sub-block b
   block(std::size_t size, block &&b) {
     // Add an extra cache line for the alignment
-    auto extended_size =
-        size + cache_line_size + info_offset;
-    void *alloc = ::operator new(extended_size);
+    auto bitmap_bytes = bitmap_size(size);
+    auto extended_size = size + cache_line_size + info_offset + bitmap_bytes;
+    std::size_t mapped_size;
+    void *alloc = acquire(extended_size, mapped_size);
     void *aligned_alloc_void = alloc;
     if (!std::align(cache_line_size, size, aligned_alloc_void, extended_size)) {
-      ::operator delete(alloc);
+      release(alloc, mapped_size);
       throw std::bad_alloc();
     }
     aligned_alloc = reinterpret_cast<char *>(aligned_alloc_void) + info_offset;
     auto &info = get_info();
     info.underlying_ptr = alloc;
     info.previous_block = std::exchange(b.aligned_alloc, nullptr);
-    info.size =
-        (reinterpret_cast<char *>(alloc) + extended_size) - aligned_alloc;
+    // The bitmap takes the end of the allocation, which is word aligned
+    auto bitmap = reinterpret_cast<char *>(alloc) + extended_size - bitmap_bytes;
+    bitmap -= reinterpret_cast<std::uintptr_t>(bitmap) % alignof(std::uint64_t);
+    info.size = bitmap - aligned_alloc;
     info.current_offset = aligned_alloc;
+    info.mapped_size = mapped_size;
+    info.clean_offset = mapped_size ? aligned_alloc : aligned_alloc + info.size;
+    info.deferred_lines = reinterpret_cast<std::uint64_t *>(bitmap);
+    info.marks = 0;
+    // Mapped memory is already zero
+    if (!mapped_size)
+      std::memset(bitmap, 0, bitmap_bytes);
   }
   block(std::size_t size) : block(size, block()) {}
 
   block &operator=(block &&other) {
-    aligned_alloc = std::exchange(other.aligned_alloc, nullptr);
+    if (this != &other) {
+      block old(std::move(*this));
+      aligned_alloc = std::exchange(other.aligned_alloc, nullptr);
+    }
     return *this;
   }
   block &operator=(const block &other) = delete;
 
+  // Releases the whole chain beneath this block. The chain is walked
+  // iteratively so that tearing down a long chain (e.g. at thread exit) uses
+  // constant native stack space
   ~block() {
-    if (aligned_alloc) {
-      block inner_block(get_info().previous_block);
-      ::operator delete(get_info().underlying_ptr);
+    auto p = std::exchange(aligned_alloc, nullptr);
+    while (p) {
+      auto &info = get_info(p);
+      auto underlying_ptr = info.underlying_ptr;
+      auto mapped_size = info.mapped_size;
+      p = info.previous_block;
+      release(underlying_ptr, mapped_size);
     }
   }
 
   operator bool() { return aligned_alloc; }
 
-  char *alloc(std::size_t s) {
+  // Allocates s bytes aligned to alignment (a power of two)
+  char *alloc(std::size_t s, std::size_t alignment = cache_line_size) {
+    if (!aligned_alloc)
+      return nullptr;
     auto &info = get_info();
-    if (!(aligned_alloc &&
-          s <= std::size_t((aligned_alloc + info.size) - info.current_offset)))
+    auto padding =
+        -reinterpret_cast<std::uintptr_t>(info.current_offset) & (alignment - 1);
+    auto available =
+        std::size_t((aligned_alloc + info.size) - info.current_offset);
+    if (!(padding <= available && s <= available - padding))
       return nullptr;
-    auto ret_ptr = info.current_offset;
-    info.current_offset += s;
+    auto ret_ptr = info.current_offset + padding;
+    info.current_offset = ret_ptr + s;
     return ret_ptr;
   }
 
-  bool dealloc(char *p) {
+  bool contains(const char *p) const {
+    return aligned_alloc && p >= aligned_alloc &&
+           p <= aligned_alloc + get_info().size;
+  }
+
+  // Returns the start of the block, which identifies it within a chain
+  char *data() const { return aligned_alloc; }
+
+  // Returns the next offset that would be allocated
+  char *top() const { return get_info().current_offset; }
+
+  // Records that everything below the top has been handed out, returning the
+  // previous start of the never-used memory
+  char *touch() {
     auto &info = get_info();
-    if (!(aligned_alloc && p >= aligned_alloc && p < aligned_alloc + info.size))
-      return false;
-    if (p < info.current_offset)
-      info.current_offset = p;
-    return true;
+    auto clean_offset = info.clean_offset;
+    if (clean_offset < info.current_offset)
+      info.clean_offset = info.current_offset;
+    return clean_offset;
   }
 
+  // Releases everything allocated from p onwards
+  void rewind(char *p) { get_info().current_offset = p; }
+
   std::size_t size() const {
     if (aligned_alloc)
       return get_info().size;
     return 0;
   }
 
+  // Returns the number of bytes handed out from this block
+  std::size_t used() const {
+    if (aligned_alloc)
+      return get_info().current_offset - aligned_alloc;
+    return 0;
+  }
+
+  // Records that the cache lines of [begin, end) were released out of order.
+  // begin may lie in any block of the chain beneath this one
+  void defer(char *begin, char *end) {
+    auto p = aligned_alloc;
+    while (p && !(begin >= p && begin < p + get_info(p).size))
+      p = get_info(p).previous_block;
+    if (p)
+      update_bits(get_info(p).deferred_lines, line_of(p, begin),
+                  line_of(p, end), true);
+  }
+
+  // Releases the lines directly beneath the top that were released out of
+  // order, returning the number of bytes reclaimed
+  std::size_t reclaim_deferred() {
+    if (!aligned_alloc)
+      return 0;
+    auto &info = get_info();
+    // Frames can leave the top mid-line, and then the line is still in use
+    if ((info.current_offset - aligned_alloc) % cache_line_size)
+      return 0;
+    auto last = line_of(aligned_alloc, info.current_offset);
+    auto first = run_start(info.deferred_lines, last);
+    update_bits(info.deferred_lines, first, last, false);
+    info.current_offset = aligned_alloc + first * cache_line_size;
+    return (last - first) * cache_line_size;
+  }
+
+  // Forgets the out of order releases from p onwards, which are about to be
+  // released in bulk
+  void forget_deferred(const char *p) {
+    if (!aligned_alloc)
+      return;
+    auto &info = get_info();
+    auto first = (std::size_t(p - aligned_alloc) + cache_line_size - 1) /
+                 cache_line_size;
+    auto last = (std::size_t(info.current_offset - aligned_alloc) +
+                 cache_line_size - 1) /
+                cache_line_size;
+    update_bits(info.deferred_lines, first, last, false);
+  }
+
+  // Keeps the block in the chain while a marker taken in it is open, even if
+  // it empties
+  void pin() { ++get_info().marks; }
+  void unpin() { --get_info().marks; }
+  bool pinned() const { return aligned_alloc && get_info().marks; }
+
+  // Makes the whole block available for allocation again
+  void reset() {
+    if (!aligned_alloc)
+      return;
+    forget_deferred(aligned_alloc);
+    get_info().current_offset = aligned_alloc;
+  }
+
+  bool has_previous_block() const {
+    return aligned_alloc && get_info().previous_block;
+  }
+
   block previous_block() {
+    if (!aligned_alloc)
+      return {};
     return {std::exchange(get_info().previous_block, nullptr)};
   }
 
@@ -126,10 +417,6 @@ public:
   }
 };
 
-thread_local block current_block;
-thread_local block spare_block;
-thread_local size_t max_alloc_size = 64;
-
 std::size_t round_up_to_power_of_2(std::size_t s) {
   s--;
   s |= s >> 1;
@@ -147,49 +434,419 @@ std::size_t round_up_to_power_of_2(std::size_t s) {
 
 } // namespace
 
-void stackalloc::detail::deallocate(char *p) {
-  if (!p)
-    return;
-  while (current_block) {
-    if (current_block.dealloc(p))
-      return;
+// The complete state of one stack allocator: its chain of blocks, the cached
+// spare block and the growth policy
+struct stackalloc::detail::arena_state {
+  block current_block;
+  block spare_block;
+  size_t max_alloc_size = 64;
+  // If set, new blocks are no larger than this (unless an allocation needs
+  // more), so the chain grows longer rather than its blocks larger
+  std::size_t max_block_size = 0;
+  // The number of allocations that have not been deallocated yet
+  std::size_t live_allocations = 0;
+  // The bytes currently handed out across the chain, and the most that have
+  // been handed out at once since the chain was last compacted
+  std::size_t used_size = 0;
+  std::size_t peak_size = 0;
+  // The most recent allocation, and where the never-used memory in its block
+  // started before it was made
+  char *last_alloc = nullptr;
+  char *last_clean_offset = nullptr;
+  // Set when the stack emptied with a fragmented chain, which is collapsed
+  // before the next allocation rather than while releasing
+  bool compact_pending = false;
 
-    // deallocate the whole block if p isn't in it
+  // Releases the top of the current block down to p, along with any deferred
+  // releases that end up on top as a result
+  void rewind(char *p) {
+    used_size -= current_block.top() - p;
+    current_block.rewind(p);
+    reclaim_deferred();
+  }
+
+  // Records a release that has to wait for the allocations above it. Each
+  // block marks its released lines in a bitmap, so this neither allocates nor
+  // depends on the order of releases
+  void defer(char *begin, char *end) { current_block.defer(begin, end); }
+
+  void reclaim_deferred() { used_size -= current_block.reclaim_deferred(); }
+
+  // Moves the current block to the spare slot (or frees it) and continues
+  // with the block beneath it
+  void pop_block() {
     auto previous_block = current_block.previous_block();
+    current_block.reset();
     // Overwrite the spare block if the one we're removing is bigger
     if (!spare_block || spare_block.size() < current_block.size())
       spare_block = std::move(current_block);
     current_block = std::move(previous_block);
   }
+
+  // Bumps s bytes at the given alignment, growing the chain if necessary
+  char *bump(std::size_t s, std::size_t alignment) {
+    settle();
+    auto top = current_block ? current_block.top() : nullptr;
+    auto ptr = current_block.alloc(s, alignment);
+    // Try to use the spare block and avoid an unnecessary allocation
+    if (!ptr && (ptr = spare_block.alloc(s, alignment))) {
+      spare_block.push_block(std::move(current_block));
+      current_block = std::move(spare_block);
+      top = current_block.data();
+    }
+    if (ptr) {
+      used_size += current_block.top() - top;
+      if (peak_size < used_size)
+        peak_size = used_size;
+      last_alloc = ptr;
+      last_clean_offset = current_block.touch();
+      return ptr;
+    }
+
+    // Leave room to align within a block if cache line alignment isn't enough
+    auto alloc_size = s;
+    if (alignment > cache_line_size)
+      alloc_size += alignment;
+
+    // Keep max_alloc_size growing
+    if (max_alloc_size <= current_block.size())
+      max_alloc_size *= 4;
+
+    // Make sure that we could produce at least four allocations in a block
+    // without hitting the backing allocation implementation
+    if (max_alloc_size < (alloc_size * 4) * 2) {
+      auto new_max_alloc_size = round_up_to_power_of_2(alloc_size * 4);
+      if (max_alloc_size < new_max_alloc_size)
+        max_alloc_size = new_max_alloc_size;
+    }
+
+    auto block_size = max_alloc_size;
+    if (max_block_size && block_size > max_block_size)
+      block_size = std::max(max_block_size, alloc_size);
+    block new_block(block_size, std::move(current_block));
+    current_block = std::move(new_block);
+    return bump(s, alignment);
+  }
+
+  // Called whenever the number of live allocations drops to zero. Releasing
+  // can't fail, so a fragmented chain is only marked for compaction here
+  void emptied() {
+    if (current_block.has_previous_block() || spare_block)
+      compact_pending = true;
+    else
+      current_block.reset();
+    used_size = 0;
+  }
+
+  // Collapses a chain that was fragmented when the stack last emptied, unless
+  // something has been allocated since
+  void settle() {
+    if (!compact_pending || live_allocations)
+      return;
+    compact_pending = false;
+    compact();
+  }
+
+  // Replaces the chain and the spare block with a single block that can hold
+  // the peak usage, so that later bursts of the same depth never cross a block
+  // boundary. Only valid while nothing is allocated
+  void compact() {
+    // Keep the largest block we already own rather than allocating a new one
+    block kept;
+    auto chain = std::move(current_block);
+    while (chain) {
+      auto previous_block = chain.previous_block();
+      if (chain.size() > kept.size())
+        kept = std::move(chain);
+      chain = std::move(previous_block);
+    }
+    if (spare_block.size() > kept.size())
+      kept = std::move(spare_block);
+    spare_block = block();
+
+    if (kept.size() < peak_size) {
+      try {
+        kept = block(round_up_to_power_of_2(peak_size));
+      } catch (const std::bad_alloc &) {
+        // Carry on with the largest block, growing again as before
+      }
+    }
+    kept.reset();
+    if (max_alloc_size < kept.size())
+      max_alloc_size = kept.size();
+
+    current_block = std::move(kept);
+    used_size = 0;
+    peak_size = 0;
+  }
+};
+
+namespace {
+
+// Every thread starts out allocating from its own arena, until an arena_scope
+// installs another one
+thread_local stackalloc::detail::arena_state thread_arena;
+thread_local stackalloc::detail::arena_state *current_arena_state = nullptr;
+
+} // namespace
+
+stackalloc::detail::arena_state *stackalloc::detail::current_arena() noexcept {
+  return current_arena_state ? current_arena_state : &thread_arena;
+}
+
+stackalloc::detail::arena_state *
+stackalloc::detail::exchange_arena(arena_state *state) noexcept {
+  return std::exchange(current_arena_state, state);
+}
+
+stackalloc::arena::arena() : state(new detail::arena_state) {}
+
+stackalloc::arena::~arena() { delete state; }
+
+void stackalloc::detail::deallocate(arena_state *state, char *p,
+                                    std::size_t s) {
+  if (!p)
+    return;
+  auto end = p + round_to_cache_lines(s);
+  auto &current_block = state->current_block;
+  while (current_block) {
+    if (current_block.contains(p) || current_block.used() ||
+        current_block.pinned()) {
+      // Anything that isn't on top is still covered by a live allocation, so
+      // its release waits until the allocations above it are gone
+      if (current_block.contains(p) && end == current_block.top())
+        state->rewind(p);
+      else
+        state->defer(p, end);
+      if (--state->live_allocations == 0)
+        state->emptied();
+      return;
+    }
+
+    // deallocate the whole block if p isn't in it
+    state->pop_block();
+    state->reclaim_deferred();
+  }
   throw("deallocated unmanaged memory");
 }
 
-char *stackalloc::detail::allocate(std::size_t s) {
-  auto alloc_size = round_to_cache_lines(s);
+void stackalloc::detail::limit_block_size(arena_state *state,
+                                          std::size_t size) noexcept {
+  state->max_block_size = size;
+}
+
+char *stackalloc::detail::allocate(arena_state *state, std::size_t s) {
+  auto ptr = state->bump(round_to_cache_lines(s), cache_line_size);
+  ++state->live_allocations;
+  return ptr;
+}
+
+std::size_t stackalloc::detail::allocation_alignment() noexcept {
+  return cache_line_size;
+}
+
+char *stackalloc::detail::allocate_bytes(arena_state *state, std::size_t s,
+                                         std::size_t alignment) {
+  return state->bump(s, alignment);
+}
+
+stackalloc::detail::marker stackalloc::detail::mark(arena_state *state) {
+  // The marked region counts as a live allocation, so the chain isn't
+  // compacted underneath it
+  state->settle();
+  ++state->live_allocations;
+  auto &current_block = state->current_block;
+  if (!current_block)
+    return {nullptr, nullptr};
+  // Releasing an allocation made before the marker mustn't drop its block,
+  // or release would walk past it and free the blocks beneath
+  current_block.pin();
+  return {current_block.data(), current_block.top()};
+}
+
+void stackalloc::detail::release(arena_state *state, const marker &m) {
+  auto &current_block = state->current_block;
+  // Drop the blocks that were started after the marker
+  while (current_block && current_block.data() != m.block) {
+    state->used_size -= current_block.used();
+    state->pop_block();
+  }
+  if (current_block) {
+    current_block.unpin();
+    current_block.forget_deferred(m.top);
+    state->rewind(m.top);
+  }
+  if (--state->live_allocations == 0)
+    state->emptied();
+}
+
+void stackalloc::detail::fill_zero(char *p, std::size_t s) {
+  // memset is already vectorized, so only large fills need special handling
+  if (s < streaming_threshold) {
+    std::memset(p, 0, s);
+    return;
+  }
+  alignas(cache_line_size) const char line[cache_line_size] = {};
+  store_lines(p, s, line);
+  auto lines = s / cache_line_size * cache_line_size;
+  std::memset(p + lines, 0, s - lines);
+}
+
+void stackalloc::detail::copy_streaming(char *p, const char *from,
+                                        std::size_t s) {
+  if (s < streaming_threshold) {
+    std::memcpy(p, from, s);
+    return;
+  }
+  stream_lines(p, from, s);
+  auto lines = s / cache_line_size * cache_line_size;
+  std::memcpy(p + lines, from + lines, s - lines);
+}
+
+void stackalloc::detail::fill(char *p, std::size_t s, const char *pattern,
+                              std::size_t pattern_size) {
+  if (s == 0)
+    return;
+  // Patterns that tile a cache line are replicated a whole line at a time
+  if (cache_line_size % pattern_size == 0) {
+    alignas(cache_line_size) char line[cache_line_size];
+    for (std::size_t i = 0; i < cache_line_size; i += pattern_size)
+      std::memcpy(line + i, pattern, pattern_size);
+    store_lines(p, s, line);
+    auto lines = s / cache_line_size * cache_line_size;
+    std::memcpy(p + lines, line, s - lines);
+    return;
+  }
+  // Otherwise keep doubling the filled prefix until it covers everything
+  std::memcpy(p, pattern, pattern_size);
+  for (std::size_t filled = pattern_size; filled < s; filled *= 2)
+    std::memcpy(p + filled, p, std::min(filled, s - filled));
+}
+
+bool stackalloc::detail::try_resize(arena_state *state, char *p, std::size_t s,
+                                    std::size_t new_s) {
+  auto end = p + round_to_cache_lines(s);
+  auto new_end = p + round_to_cache_lines(new_s);
+  auto &current_block = state->current_block;
+  if (current_block.contains(p) && end == current_block.top()) {
+    // The allocation is on top, so just move the top
+    if (new_end <= end) {
+      state->rewind(new_end);
+      return true;
+    }
+    auto available =
+        std::size_t(current_block.data() + current_block.size() - end);
+    if (std::size_t(new_end - end) > available)
+      return false;
+    current_block.rewind(new_end);
+    current_block.touch();
+    state->used_size += new_end - end;
+    if (state->peak_size < state->used_size)
+      state->peak_size = state->used_size;
+    return true;
+  }
+  if (new_end > end)
+    return false;
+  // Something is allocated above, so the freed tail is released once that is
+  if (new_end < end)
+    state->defer(new_end, end);
+  return true;
+}
+
+void stackalloc::detail::fill_zero(arena_state *state, char *p,
+                                   std::size_t s) {
+  // Memory in a freshly mapped block that has never been handed out is
+  // already zero, so only the part of the latest allocation below that point
+  // needs clearing
+  fill_zero(p, dirty_size(state, p, s));
+}
 
-  if (auto ptr = current_block.alloc(alloc_size))
-    return ptr;
+std::size_t stackalloc::detail::dirty_size(arena_state *state, char *p,
+                                           std::size_t s) {
+  if (p == state->last_alloc)
+    s = std::min(s, std::size_t(std::max(state->last_clean_offset, p) - p));
+  return s;
+}
 
-  // Try to use the spare block and avoid an unnecessary allocation
-  if (auto ptr = spare_block.alloc(alloc_size)){
-    spare_block.push_block(std::move(current_block));
-    current_block = std::move(spare_block);
-    return ptr;
+void stackalloc::detail::parallel_chunks(const executor &ex,
+                                         std::size_t concurrency, char *p,
+                                         std::size_t size,
+                                         std::size_t elem_size,
+                                         const chunk_function &init,
+                                         const chunk_function &undo) {
+  if (!concurrency)
+    concurrency = std::max(1u, std::thread::hardware_concurrency());
+  auto bytes = size * elem_size;
+  auto chunks = std::min(concurrency, bytes / parallel_chunk_size);
+  if (chunks <= 1) {
+    init(0, size);
+    return;
   }
 
-  // Keep max_alloc_size growing 
-  if (max_alloc_size <= current_block.size())
-    max_alloc_size *= 4;
+  // Chunk boundaries are rounded up to the next page, and then to the next
+  // whole element
+  std::vector<std::size_t> bounds(chunks + 1);
+  auto base = reinterpret_cast<std::uintptr_t>(p);
+  for (std::size_t k = 1; k < chunks; ++k) {
+    auto target = base + bytes / chunks * k;
+    auto page = (target + page_size - 1) / page_size * page_size;
+    bounds[k] = std::min(size, (page - base + elem_size - 1) / elem_size);
+  }
+  bounds[chunks] = size;
 
-  // Make sure that we could produce at least four allocations in a block
-  // without hitting the backing allocation implementation
-  if (max_alloc_size < (alloc_size * 4) * 2) {
-    auto new_max_alloc_size = round_up_to_power_of_2(alloc_size * 4);
-    if (max_alloc_size < new_max_alloc_size)
-      max_alloc_size = new_max_alloc_size;
+  // Chunks are claimed from a shared counter by the calling thread and by
+  // every task it submits, so the caller never waits on a task the executor
+  // hasn't started (e.g. when its pool is busy running the caller). Tasks
+  // that start late find nothing left and only touch the shared state, which
+  // they keep alive themselves
+  struct job {
+    std::vector<std::size_t> bounds;
+    std::atomic<std::size_t> next{0};
+    std::mutex m;
+    std::condition_variable finished;
+    std::size_t completed = 0;
+    std::exception_ptr error;
+    std::vector<char> done;
+  };
+  auto shared = std::make_shared<job>();
+  shared->bounds = std::move(bounds);
+  shared->done.resize(chunks);
+  auto work = [chunks, &init](job &j) {
+    for (std::size_t k; (k = j.next.fetch_add(1)) < chunks;) {
+      std::exception_ptr chunk_error;
+      try {
+        init(j.bounds[k], j.bounds[k + 1]);
+      } catch (...) {
+        chunk_error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(j.m);
+      if (chunk_error && !j.error)
+        j.error = chunk_error;
+      j.done[k] = !chunk_error;
+      if (++j.completed == chunks)
+        j.finished.notify_all();
+    }
+  };
+  for (std::size_t k = 1; k < chunks; ++k) {
+    try {
+      ex([shared, work] { work(*shared); });
+    } catch (...) {
+      // Chunks the executor won't take are claimed by the calling thread
+      break;
+    }
   }
+  work(*shared);
+  // Every chunk has been claimed, so only wait for the ones still running
+  std::unique_lock<std::mutex> lock(shared->m);
+  shared->finished.wait(lock, [&] { return shared->completed == chunks; });
+  auto error = shared->error;
+  auto &done = shared->done;
+  lock.unlock();
 
-  block new_block(max_alloc_size, std::move(current_block));
-  current_block = std::move(new_block);
-  return allocate(s);
+  if (error) {
+    for (std::size_t k = chunks; k-- > 0;)
+      if (done[k])
+        undo(shared->bounds[k], shared->bounds[k + 1]);
+    std::rethrow_exception(error);
+  }
 }
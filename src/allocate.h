@@ -1,30 +1,327 @@
+#pragma once
+
+#include "stack_span.h"
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
 #include <type_traits>
 #include <utility>
 
 namespace stackalloc {
 
+class arena;
+template <typename T> class stack_ptr;
+
 namespace detail {
-void deallocate(char *p);
-char *allocate(std::size_t);
+// The state of a single stack allocator, defined in allocate.cpp
+struct arena_state;
+
+// Returns the arena the calling thread currently allocates from
+arena_state *current_arena() noexcept;
+// Makes state the calling thread's current arena (nullptr restores the
+// thread's own arena) and returns the previously installed one
+arena_state *exchange_arena(arena_state *state) noexcept;
+
+// Releases an allocation of s bytes. Allocations are expected to be released
+// in LIFO order; one that isn't is reclaimed once everything above it is gone
+void deallocate(arena_state *state, char *p, std::size_t s);
+char *allocate(arena_state *state, std::size_t);
+// Caps the size of the blocks state allocates from now on (0 lifts the cap),
+// so that it grows by lengthening its chain of blocks instead
+void limit_block_size(arena_state *state, std::size_t size) noexcept;
+// The alignment of every allocation made by allocate (a cache line)
+std::size_t allocation_alignment() noexcept;
+// Resizes the allocation of s bytes at p to new_s bytes without moving it.
+// Shrinking always succeeds; growing only succeeds if the allocation is on top
+// of its arena and there is room left in its block
+bool try_resize(arena_state *state, char *p, std::size_t s, std::size_t new_s);
+
+// Allocates s bytes at the given alignment without rounding to cache lines.
+// These allocations are never released individually, only through release
+char *allocate_bytes(arena_state *state, std::size_t s, std::size_t alignment);
+
+// A position in an arena that it can later be released back to
+struct marker {
+  char *block;
+  char *top;
+};
+marker mark(arena_state *state);
+// Releases everything allocated since m was taken
+void release(arena_state *state, const marker &m);
+
+arena_state *get_state(arena &a) noexcept;
+
+template <typename T, class... Args>
+stack_ptr<T> make_object(arena_state *state, Args &&... args);
+template <typename T, typename Init>
+stack_ptr<T[]> make_array(arena_state *state, std::size_t size, Init &&init,
+                          std::size_t padding = 0);
+template <typename T> void relocate(T *from, std::size_t size, T *to);
+
+// Bulk initialization of freshly allocated, cache line aligned memory. Fills
+// larger than the L2 cache use non-temporal stores so that they don't evict
+// the working set
+void fill_zero(char *p, std::size_t s);
+// Zeroes an allocation just made from state, skipping memory that is known to
+// be zero because it is fresh from the kernel and has never been handed out
+void fill_zero(arena_state *state, char *p, std::size_t s);
+// Returns how many leading bytes of an allocation of s bytes just made at p
+// might not be zero, and so need clearing
+std::size_t dirty_size(arena_state *state, char *p, std::size_t s);
+// Fills s bytes with repeated copies of a pattern of pattern_size bytes
+void fill(char *p, std::size_t s, const char *pattern,
+          std::size_t pattern_size);
+// Copies s bytes to cache line aligned memory at p. Large copies use
+// non-temporal stores, for data that won't be read again soon
+void copy_streaming(char *p, const char *from, std::size_t s);
+
+// Runs a task, possibly on another thread
+using executor = std::function<void(std::function<void()>)>;
+using chunk_function = std::function<void(std::size_t, std::size_t)>;
+// Runs init(begin, end) over chunks of the size elements of elem_size bytes
+// at p, spread over up to concurrency threads of ex. Chunks start on page
+// boundaries so every page is first touched by one thread. If a chunk throws,
+// undo(begin, end) runs on the chunks that finished and the exception is
+// rethrown
+void parallel_chunks(const executor &ex, std::size_t concurrency, char *p,
+                     std::size_t size, std::size_t elem_size,
+                     const chunk_function &init, const chunk_function &undo);
+
+template <typename It, typename = void>
+struct is_forward_iterator : std::false_type {};
+template <typename It>
+struct is_forward_iterator<
+    It, std::void_t<typename std::iterator_traits<It>::iterator_category>>
+    : std::is_convertible<typename std::iterator_traits<It>::iterator_category,
+                          std::forward_iterator_tag> {};
+template <typename It>
+using enable_if_forward_iterator_t =
+    std::enable_if_t<is_forward_iterator<It>::value>;
+// Generators are callables that aren't themselves values of the element type
+template <typename T, typename Gen>
+using enable_if_generator_t = std::enable_if_t<
+    (std::is_invocable_v<Gen &> || std::is_invocable_v<Gen &, std::size_t>) &&
+    !std::is_convertible_v<Gen, std::remove_extent_t<T>>>;
+// Generators that can run out of order take the index of the element
+template <typename T, typename Gen>
+using enable_if_indexed_generator_t =
+    std::enable_if_t<std::is_invocable_v<const Gen &, std::size_t> &&
+                     !std::is_convertible_v<Gen, std::remove_extent_t<T>>>;
+
+// The size of the allocation owned by a stack_ptr<T>. Polymorphic objects can
+// be owned through a base class, so only they need to store it
+template <typename T, bool = std::is_polymorphic_v<T>> class allocation_size {
+public:
+  explicit allocation_size(std::size_t) noexcept {}
+  std::size_t get_size() const noexcept { return sizeof(T); }
+};
+template <typename T> class allocation_size<T, true> {
+  std::size_t s;
+
+public:
+  explicit allocation_size(std::size_t s) noexcept : s(s) {}
+  std::size_t get_size() const noexcept { return s; }
+};
+
+// Destroys the elements of [first, last) from the last to the first, the order
+// delete[] uses
+template <typename T> void destroy_backward(T *first, T *last) {
+  if constexpr (!std::is_trivially_destructible_v<T>)
+    while (last != first)
+      (--last)->~T();
+}
+
+template <typename T>
+using enable_if_object_t =
+    std::enable_if_t<!std::is_abstract_v<T> && !std::is_function_v<T> &&
+                     !std::is_array_v<T>>;
+template <typename T>
+using enable_if_array_t =
+    std::enable_if_t<!std::is_abstract_v<T> && !std::is_function_v<T> &&
+                     std::is_array_v<T>>;
 } // namespace detail
 
-// Forward decls for friend functions
-template <typename T> class stack_ptr;
-template <
-    typename T,
-    typename = std::enable_if_t<!std::is_abstract_v<T> && !std::is_function_v<T> &&
-                                !std::is_array_v<T>>,
-    class... Args>
+// An independent stack allocator with its own chain of blocks.
+// Every thread implicitly owns one arena, which is what make_stack_ptr uses by
+// default. Explicit arenas are not tied to a thread, so they can follow a task
+// between threads, but must only be used by one thread at a time. All
+// stack_ptrs allocated from an arena must be destroyed before the arena is
+class arena {
+  detail::arena_state *state;
+
+  friend detail::arena_state *detail::get_state(arena &) noexcept;
+
+public:
+  arena();
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+  ~arena();
+};
+
+// Makes an arena the calling thread's current arena until the end of the
+// scope, so that make_stack_ptr allocates from it
+class arena_scope {
+  detail::arena_state *previous;
+
+public:
+  explicit arena_scope(arena &a)
+      : previous(detail::exchange_arena(detail::get_state(a))) {}
+  arena_scope(const arena_scope &) = delete;
+  arena_scope &operator=(const arena_scope &) = delete;
+  ~arena_scope() { detail::exchange_arena(previous); }
+};
+
+// An opaque handle to an allocator context: the chain of blocks, cursor,
+// spare block and growth state that make_stack_ptr allocates from.
+// User-space schedulers can give each fiber its own stack allocator by
+// exchanging contexts whenever they switch fibers
+class context {
+  detail::arena_state *state;
+
+  explicit context(detail::arena_state *state) noexcept : state(state) {}
+
+  friend context current_context() noexcept;
+  friend context exchange_context(context c) noexcept;
+
+public:
+  // The context of an arena, which must outlive any use of the handle
+  explicit context(arena &a) noexcept : state(detail::get_state(a)) {}
+};
+
+// Returns the calling thread's current context
+inline context current_context() noexcept {
+  return context(detail::current_arena());
+}
+
+// Installs c as the calling thread's context, and returns the context it
+// replaces so that it can be reinstalled later
+inline context exchange_context(context c) noexcept {
+  auto previous = detail::current_arena();
+  detail::exchange_arena(c.state);
+  return context(previous);
+}
+
+// The alignment of every array allocation that is known at compile time. The
+// library aligns allocations to the cache line, which is at least this
+#if defined(__x86_64__) || defined(__i386__)
+inline constexpr std::size_t stack_alignment = 64;
+#else
+inline constexpr std::size_t stack_alignment = alignof(std::max_align_t);
+#endif
+
+// The readable slack guaranteed after the elements of a padded array, enough
+// for a full width vector load starting at any element
+inline constexpr std::size_t tail_padding = 64;
+
+// Tag requesting an array with tail_padding bytes of slack after its elements
+struct padded_t {
+  explicit padded_t() = default;
+};
+inline constexpr padded_t padded{};
+
+// Tag requesting that an array is filled with non-temporal stores, for large
+// data that is processed once and shouldn't evict the working set
+struct streaming_t {
+  explicit streaming_t() = default;
+};
+inline constexpr streaming_t streaming{};
+
+// Requests that an array is initialized in chunks spread over an executor,
+// which is anything that runs a std::function<void()>, typically by posting it
+// to a thread pool. Up to concurrency chunks run at once, defaulting to the
+// number of hardware threads. Only arrays of at least a few MiB are split
+struct parallel_t {
+  detail::executor ex;
+  std::size_t concurrency;
+};
+inline parallel_t parallel(detail::executor ex, std::size_t concurrency = 0) {
+  return {std::move(ex), concurrency};
+}
+
+// Forward decls for factory functions
+template <typename T, typename = detail::enable_if_object_t<T>, class... Args>
 stack_ptr<T> make_stack_ptr(Args &&... args);
-template <typename T,
-          typename = std::enable_if_t<!std::is_abstract_v<T> &&
-                                      !std::is_function_v<T> && std::is_array_v<T>>>
+template <typename T, typename = detail::enable_if_object_t<T>, class... Args>
+stack_ptr<T> make_stack_ptr(arena &a, Args &&... args);
+template <typename T, typename = detail::enable_if_array_t<T>>
 stack_ptr<T> make_stack_ptr(std::size_t size);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(std::size_t size,
+                            const std::remove_extent_t<T> &value);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size,
+                            const std::remove_extent_t<T> &value);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(std::size_t size, padded_t);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, padded_t);
+template <typename T, typename = detail::enable_if_array_t<T>, typename It,
+          typename = detail::enable_if_forward_iterator_t<It>>
+stack_ptr<T> make_stack_ptr(It first, It last);
+template <typename T, typename = detail::enable_if_array_t<T>, typename It,
+          typename = detail::enable_if_forward_iterator_t<It>>
+stack_ptr<T> make_stack_ptr(arena &a, It first, It last);
+template <typename T, typename = detail::enable_if_array_t<T>, typename Gen,
+          typename = detail::enable_if_generator_t<T, Gen>>
+stack_ptr<T> make_stack_ptr(std::size_t size, Gen gen);
+template <typename T, typename = detail::enable_if_array_t<T>, typename Gen,
+          typename = detail::enable_if_generator_t<T, Gen>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, Gen gen);
+template <typename T, typename = detail::enable_if_array_t<T>, typename It,
+          typename = detail::enable_if_forward_iterator_t<It>>
+stack_ptr<T> make_stack_ptr(It first, It last, streaming_t);
+template <typename T, typename = detail::enable_if_array_t<T>, typename It,
+          typename = detail::enable_if_forward_iterator_t<It>>
+stack_ptr<T> make_stack_ptr(arena &a, It first, It last, streaming_t);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(std::size_t size, const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(std::size_t size,
+                            const std::remove_extent_t<T> &value,
+                            const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size,
+                            const std::remove_extent_t<T> &value,
+                            const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>, typename Gen,
+          typename = detail::enable_if_indexed_generator_t<T, Gen>>
+stack_ptr<T> make_stack_ptr(std::size_t size, Gen gen, const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>, typename Gen,
+          typename = detail::enable_if_indexed_generator_t<T, Gen>>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, Gen gen,
+                            const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr_for_overwrite(std::size_t size);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr_for_overwrite(arena &a, std::size_t size);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr_zeroed(std::size_t size);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr_zeroed(arena &a, std::size_t size);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr_zeroed(std::size_t size, const parallel_t &par);
+template <typename T, typename = detail::enable_if_array_t<T>>
+stack_ptr<T> make_stack_ptr_zeroed(arena &a, std::size_t size,
+                                   const parallel_t &par);
 
 // A class for a managed allocation (object variation)
 // These objects cannot be copied, and will deallocate themselves at the end of
-// the scope in which they were allocated
-template <typename T> class stack_ptr {
+// the scope in which they were allocated.
+// A stack_ptr can be moved out of the function that made it, handing the
+// allocation to the caller's scope. The allocation stays where it is in the
+// arena: anything the function allocated after it is released as usual, while
+// anything allocated before it is only reclaimed once it is released too.
+// Moving never reorders the stack, so it can't be assigned to.
+// A stack_ptr<Derived> converts to a stack_ptr<Base> when Base has a virtual
+// destructor, which lets objects chosen at runtime live on the stack
+template <typename T> class stack_ptr : detail::allocation_size<T> {
 public:
   using pointer = T *;
   using element_type = T;
@@ -33,19 +330,49 @@ private:
   // The underlying pointer
   pointer p;
 
-  // Constructs a stack_ptr from a raw pointer and size
-  stack_ptr(pointer p) : p(p) {}
-  stack_ptr(stack_ptr &&s) = default;
-  stack_ptr &&operator=(stack_ptr &&s) = delete;
-  stack_ptr(const stack_ptr &s) = delete;
-  stack_ptr &operator=(const stack_ptr &s) = delete;
+  // The arena the allocation belongs to
+  detail::arena_state *a;
+
+  // Constructs a stack_ptr from a raw pointer and its arena
+  stack_ptr(pointer p, detail::arena_state *a)
+      : detail::allocation_size<T>(sizeof(T)), p(p), a(a) {}
 
   // This friend function needs access to the constructors to perform allocation
-  template <typename U, typename V, class... Args>
-  friend stack_ptr<U> make_stack_ptr(Args &&...);
+  template <typename U, class... Args>
+  friend stack_ptr<U> detail::make_object(detail::arena_state *, Args &&...);
+  // Conversions need access to other stack_ptrs' allocations
+  template <typename U> friend class stack_ptr;
 
 public:
-  ~stack_ptr() { detail::deallocate(reinterpret_cast<char *>(p)); }
+  // Takes over the allocation, leaving s empty
+  stack_ptr(stack_ptr &&s) noexcept
+      : detail::allocation_size<T>(s.get_size()),
+        p(std::exchange(s.p, nullptr)), a(s.a) {}
+  // Takes over an allocation of a derived class, leaving s empty
+  template <typename U,
+            typename = std::enable_if_t<!std::is_same_v<U, T> &&
+                                        std::is_convertible_v<U *, T *> &&
+                                        std::has_virtual_destructor_v<T>>>
+  stack_ptr(stack_ptr<U> &&s) noexcept
+      : detail::allocation_size<T>(s.get_size()),
+        p(std::exchange(s.p, nullptr)), a(s.a) {}
+  stack_ptr &operator=(stack_ptr &&s) = delete;
+  stack_ptr(const stack_ptr &s) = delete;
+  stack_ptr &operator=(const stack_ptr &s) = delete;
+
+  ~stack_ptr() {
+    // The allocation starts at the most derived object, which may not be
+    // where a base class subobject lives
+    char *allocation;
+    if constexpr (std::is_polymorphic_v<T>)
+      allocation = static_cast<char *>(dynamic_cast<void *>(p));
+    else
+      allocation = reinterpret_cast<char *>(p);
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      if (p)
+        p->~T();
+    detail::deallocate(a, allocation, this->get_size());
+  }
   // Observers:
 
   // Returns a pointer to the managed object
@@ -69,48 +396,536 @@ private:
   // The size of the allocated block
   std::size_t s;
 
-  // Constructs a stack_ptr from a raw pointer and size
-  stack_ptr(pointer p, std::size_t s) : p(p), s(s) {}
-  stack_ptr &&operator=(stack_ptr &&s) = delete;
-  stack_ptr(const stack_ptr &s) = delete;
-  stack_ptr &operator=(const stack_ptr &s) = delete;
+  // The arena the allocation belongs to
+  detail::arena_state *a;
+
+  // The bytes of slack allocated after the elements
+  std::size_t padding;
+
+  // Constructs a stack_ptr from a raw pointer, size, arena and padding
+  stack_ptr(pointer p, std::size_t s, detail::arena_state *a,
+            std::size_t padding)
+      : p(p), s(s), a(a), padding(padding) {}
 
   // This friend function needs access to the constructors to perform allocation
-  template <typename U, typename V>
-  friend stack_ptr<U> make_stack_ptr(std::size_t);
+  template <typename U, typename Init>
+  friend stack_ptr<U[]> detail::make_array(detail::arena_state *, std::size_t,
+                                           Init &&, std::size_t);
+
+  // The bytes allocated for size elements
+  std::size_t bytes(std::size_t size) const noexcept {
+    return sizeof(T) * size + padding;
+  }
 
 public:
-  ~stack_ptr() { detail::deallocate(reinterpret_cast<char *>(p)); }
+  // Takes over the allocation, leaving other empty
+  stack_ptr(stack_ptr &&other) noexcept
+      : p(std::exchange(other.p, nullptr)), s(std::exchange(other.s, 0)),
+        a(other.a), padding(other.padding) {}
+  stack_ptr &operator=(stack_ptr &&other) = delete;
+  stack_ptr(const stack_ptr &other) = delete;
+  stack_ptr &operator=(const stack_ptr &other) = delete;
+
+  ~stack_ptr() {
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      detail::destroy_backward(p, p + s);
+    detail::deallocate(a, reinterpret_cast<char *>(p), bytes(s));
+  }
 
   // Observers:
 
-  // Returns a pointer to the managed object
-  pointer get() const noexcept { return p; }
+  // Returns a pointer to the managed object, which is known to be aligned to
+  // stack_alignment
+  pointer get() const noexcept {
+    return stackalloc::assume_aligned<stack_alignment>(p);
+  }
   pointer data() const noexcept { return get(); }
 
+  // Returns a view of the elements that carries their alignment
+  stack_span<T, stack_alignment> span() const noexcept { return {p, s}; }
+
   // Returns the number of elements in the allocation
   std::size_t size() const noexcept { return s; }
 
+  // Returns the number of elements that can be read from get() without
+  // leaving the allocation. Past size() these are padding, with unspecified
+  // contents; arrays made with padded have at least tail_padding bytes of it
+  std::size_t padded_size() const noexcept {
+    auto line = detail::allocation_alignment();
+    return p ? (bytes(s) + line - 1) / line * line / sizeof(T) : 0;
+  }
+
   // Provides access to elements of managed array
   T &operator[](std::size_t i) const { return get()[i]; }
 
   // Iterators:
-  pointer begin() const noexcept { return p; }
+  pointer begin() const noexcept { return get(); }
   const pointer cbegin() const noexcept { return begin(); }
-  pointer end() const noexcept { return p + s; }
+  pointer end() const noexcept { return get() + s; }
   const pointer cend() const noexcept { return end(); }
+
+  // Modifiers:
+
+  // Grows the array in place to new_size elements, which only works while
+  // nothing has been allocated after it. New elements are default-initialized.
+  // Returns false, leaving the array unchanged, if it can't grow in place
+  bool try_grow(std::size_t new_size) {
+    if (new_size < s)
+      return false;
+    if (!detail::try_resize(a, reinterpret_cast<char *>(p), bytes(s),
+                            bytes(new_size)))
+      return false;
+    if constexpr (!std::is_trivially_default_constructible_v<T>) {
+      try {
+        std::uninitialized_default_construct(p + s, p + new_size);
+      } catch (...) {
+        detail::try_resize(a, reinterpret_cast<char *>(p), bytes(new_size),
+                           bytes(s));
+        throw;
+      }
+    }
+    s = new_size;
+    return true;
+  }
+
+  // Destroys the elements past new_size and releases their memory
+  void shrink_to(std::size_t new_size) {
+    if (new_size >= s)
+      return;
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      detail::destroy_backward(p + new_size, p + s);
+    detail::try_resize(a, reinterpret_cast<char *>(p), bytes(s),
+                       bytes(new_size));
+    s = new_size;
+  }
+
+  // Changes the number of elements to new_size, relocating the array to the
+  // top of its arena if it can't grow in place. Relocating invalidates
+  // pointers to the elements, and the old storage is only reclaimed once
+  // everything allocated after it has been released
+  void resize(std::size_t new_size) {
+    if (new_size <= s) {
+      shrink_to(new_size);
+      return;
+    }
+    if (try_grow(new_size))
+      return;
+
+    auto new_p =
+        reinterpret_cast<pointer>(detail::allocate(a, bytes(new_size)));
+    try {
+      detail::relocate(p, s, new_p);
+      try {
+        if constexpr (!std::is_trivially_default_constructible_v<T>)
+          std::uninitialized_default_construct(new_p + s, new_p + new_size);
+      } catch (...) {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+          detail::destroy_backward(new_p, new_p + s);
+        throw;
+      }
+    } catch (...) {
+      detail::deallocate(a, reinterpret_cast<char *>(new_p), bytes(new_size));
+      throw;
+    }
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      detail::destroy_backward(p, p + s);
+    detail::deallocate(a, reinterpret_cast<char *>(p), bytes(s));
+    p = new_p;
+    s = new_size;
+  }
+};
+
+namespace detail {
+inline arena_state *get_state(arena &a) noexcept { return a.state; }
+
+// Runs init on freshly allocated memory, releasing the memory again if init
+// throws
+template <typename F>
+auto initialize(arena_state *state, char *p, std::size_t s, F &&init) {
+  try {
+    return init();
+  } catch (...) {
+    deallocate(state, p, s);
+    throw;
+  }
+}
+
+template <typename T, class... Args>
+stack_ptr<T> make_object(arena_state *state, Args &&... args) {
+  auto p = allocate(state, sizeof(T));
+  if constexpr (std::is_nothrow_constructible_v<T, Args...>)
+    return {new (p) T(std::forward<Args>(args)...), state};
+  else
+    return {initialize(state, p, sizeof(T),
+                       [&] { return new (p) T(std::forward<Args>(args)...); }),
+            state};
+}
+// Allocates an array and constructs its elements with init(p, size)
+template <typename T, typename Init>
+stack_ptr<T[]> make_array(arena_state *state, std::size_t size, Init &&init,
+                          std::size_t padding) {
+  auto bytes = sizeof(T) * size + padding;
+  auto p = reinterpret_cast<T *>(allocate(state, bytes));
+  initialize(state, reinterpret_cast<char *>(p), bytes,
+             [&] { init(p, size); });
+  return {p, size, state, padding};
+}
+
+// Array initializers:
+
+// Default-initializes elements, leaving trivial types uninitialized exactly
+// as new T[size] would
+struct default_initializer {
+  template <typename T> void operator()(T *p, std::size_t size) const {
+    if constexpr (!std::is_trivially_default_constructible_v<T>)
+      std::uninitialized_default_construct_n(p, size);
+  }
+};
+
+// Moves (or copies, if moving could throw) size elements into uninitialized
+// storage at to, leaving the originals to be destroyed by the caller
+template <typename T> void relocate(T *from, std::size_t size, T *to) {
+  // An empty container may have no buffer to move from
+  if (size == 0)
+    return;
+  if constexpr (std::is_trivially_copyable_v<T>)
+    std::memcpy(static_cast<void *>(to), from, sizeof(T) * size);
+  else if constexpr (std::is_nothrow_move_constructible_v<T> ||
+                     !std::is_copy_constructible_v<T>)
+    std::uninitialized_move_n(from, size, to);
+  else
+    std::uninitialized_copy_n(from, size, to);
+}
+
+// Value-initializes elements, zeroing trivial types in bulk
+struct value_initializer {
+  arena_state *state;
+  template <typename T> void operator()(T *p, std::size_t size) const {
+    if constexpr (std::is_trivial_v<T> && !std::is_member_pointer_v<T>)
+      fill_zero(state, reinterpret_cast<char *>(p), sizeof(T) * size);
+    else
+      std::uninitialized_value_construct_n(p, size);
+  }
+};
+
+// Copies value into every element, replicating trivially copyable values in
+// bulk
+template <typename T> struct fill_initializer {
+  const T &value;
+  void operator()(T *p, std::size_t size) const {
+    if constexpr (std::is_trivially_copyable_v<T>)
+      fill(reinterpret_cast<char *>(p), sizeof(T) * size,
+           reinterpret_cast<const char *>(std::addressof(value)), sizeof(T));
+    else
+      std::uninitialized_fill_n(p, size, value);
+  }
+};
+
+// Whether the elements behind It are contiguous in memory. Before C++20 only
+// pointers are known to be
+template <typename It>
+inline constexpr bool is_contiguous_iterator_v =
+#if defined(__cpp_lib_concepts)
+    std::contiguous_iterator<It>;
+#else
+    std::is_pointer_v<It>;
+#endif
+
+// Returns the address of the element a contiguous iterator refers to
+template <typename It> auto iterator_address(const It &it) {
+#if defined(__cpp_lib_concepts)
+  return std::to_address(it);
+#else
+  return it;
+#endif
+}
+
+// Copies the elements of a range starting at first. Ranges of trivially
+// copyable elements in contiguous storage are copied in bulk
+template <typename It> struct range_initializer {
+  It first;
+  bool streaming;
+  template <typename T> void operator()(T *p, std::size_t size) const {
+    using element = std::remove_cv_t<
+        std::remove_reference_t<decltype(*std::declval<const It &>())>>;
+    if constexpr (is_contiguous_iterator_v<It> &&
+                  std::is_same_v<element, T> &&
+                  std::is_trivially_copyable_v<T>) {
+      // An empty range may come from a null pointer
+      if (!size)
+        return;
+      auto from = iterator_address(first);
+      if (streaming)
+        copy_streaming(reinterpret_cast<char *>(p),
+                       reinterpret_cast<const char *>(from), sizeof(T) * size);
+      else
+        std::memcpy(static_cast<void *>(p), from, sizeof(T) * size);
+    } else {
+      std::uninitialized_copy_n(first, size, p);
+    }
+  }
+};
+
+// Constructs each element from gen(i), or gen() if it doesn't take an index
+template <typename Gen> struct generator_initializer {
+  Gen &gen;
+  template <typename T> void operator()(T *p, std::size_t size) const {
+    std::size_t i = 0;
+    try {
+      for (; i < size; ++i) {
+        if constexpr (std::is_invocable_v<Gen &, std::size_t>)
+          new (p + i) T(gen(i));
+        else
+          new (p + i) T(gen());
+      }
+    } catch (...) {
+      if constexpr (!std::is_trivially_destructible_v<T>)
+        destroy_backward(p, p + i);
+      throw;
+    }
+  }
 };
 
+// Constructs each element from gen(i), shifting indices by offset
+template <typename Gen> struct offset_generator {
+  const Gen &gen;
+  std::size_t offset;
+  decltype(auto) operator()(std::size_t i) const { return gen(offset + i); }
+};
+
+// Runs another initializer over chunks of the array in parallel
+template <typename Init> struct parallel_initializer {
+  const parallel_t &par;
+  Init init;
+  template <typename T> void operator()(T *p, std::size_t size) const {
+    auto undo = [p](std::size_t begin, std::size_t end) {
+      if constexpr (!std::is_trivially_destructible_v<T>)
+        destroy_backward(p + begin, p + end);
+    };
+    if constexpr (std::is_same_v<Init, default_initializer> &&
+                  std::is_trivially_default_constructible_v<T>) {
+      // Nothing to do, so don't hand out tasks for it
+      init(p, size);
+    } else if constexpr (std::is_same_v<Init, value_initializer> &&
+                  std::is_trivial_v<T> && !std::is_member_pointer_v<T>) {
+      // Only the part that isn't known to be zero needs clearing, and no
+      // element needs undoing
+      auto dirty = dirty_size(init.state, reinterpret_cast<char *>(p),
+                              sizeof(T) * size);
+      parallel_chunks(
+          par.ex, par.concurrency, reinterpret_cast<char *>(p), dirty, 1,
+          [p](std::size_t begin, std::size_t end) {
+            fill_zero(reinterpret_cast<char *>(p) + begin, end - begin);
+          },
+          [](std::size_t, std::size_t) {});
+    } else if constexpr (std::is_invocable_v<const Init &, std::size_t>) {
+      // Init is an indexed generator
+      parallel_chunks(
+          par.ex, par.concurrency, reinterpret_cast<char *>(p), size,
+          sizeof(T),
+          [&](std::size_t begin, std::size_t end) {
+            offset_generator<Init> gen{init, begin};
+            generator_initializer<offset_generator<Init>>{gen}(p + begin,
+                                                               end - begin);
+          },
+          undo);
+    } else {
+      parallel_chunks(
+          par.ex, par.concurrency, reinterpret_cast<char *>(p), size,
+          sizeof(T),
+          [&](std::size_t begin, std::size_t end) {
+            init(p + begin, end - begin);
+          },
+          undo);
+    }
+  }
+};
+} // namespace detail
+
 // Allocates and constructs stack_ptr from provided arguments
 // (drop in replacement to std::make_unique)
 template <typename T, typename, class... Args>
 stack_ptr<T> make_stack_ptr(Args &&... args) {
-  return {new (detail::allocate(sizeof(T))) T(std::forward<Args>(args)...)};
+  return detail::make_object<T>(detail::current_arena(),
+                                std::forward<Args>(args)...);
 }
+// Allocates an array of default-initialized elements. Trivial types are
+// left uninitialized
 template <typename T, typename> stack_ptr<T> make_stack_ptr(std::size_t size) {
-  return {reinterpret_cast<typename stack_ptr<T>::pointer>(detail::allocate(
-              sizeof(typename stack_ptr<T>::element_type) * size)),
-          size};
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size, detail::default_initializer{});
+}
+// Allocates an array with every element a copy of value
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(std::size_t size,
+                            const std::remove_extent_t<T> &value) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size,
+      detail::fill_initializer<std::remove_extent_t<T>>{value});
+}
+// Allocates an array of default-initialized elements followed by at least
+// tail_padding bytes of readable slack, so vector loops can load full vectors
+// past the last element instead of handling the remainder separately
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(std::size_t size, padded_t) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size, detail::default_initializer{},
+      tail_padding);
+}
+// Allocates an array holding copies of the elements of [first, last). Elements
+// are copied straight into place, so T needn't be default constructible, and
+// trivially copyable elements in contiguous storage (behind pointers, or any
+// contiguous iterator in C++20) are copied with one memcpy
+template <typename T, typename, typename It, typename>
+stack_ptr<T> make_stack_ptr(It first, It last) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), std::distance(first, last),
+      detail::range_initializer<It>{first, false});
+}
+// Allocates an array of size elements constructed from gen(i) in order, or
+// from gen() if it doesn't take the index
+template <typename T, typename, typename Gen, typename>
+stack_ptr<T> make_stack_ptr(std::size_t size, Gen gen) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size, detail::generator_initializer<Gen>{gen});
+}
+// Allocates an array holding copies of the elements of [first, last), storing
+// them with non-temporal stores when they are contiguous and trivially copyable
+template <typename T, typename, typename It, typename>
+stack_ptr<T> make_stack_ptr(It first, It last, streaming_t) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), std::distance(first, last),
+      detail::range_initializer<It>{first, true});
+}
+// Allocates an array whose elements are about to be overwritten. Equivalent to
+// make_stack_ptr(size), but makes the intent explicit
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr_for_overwrite(std::size_t size) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size, detail::default_initializer{});
+}
+// Allocates an array of value-initialized elements, so trivial types are
+// zeroed
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr_zeroed(std::size_t size) {
+  auto state = detail::current_arena();
+  return detail::make_array<std::remove_extent_t<T>>(
+      state, size, detail::value_initializer{state});
+}
+
+// Overloads allocating from an explicit arena rather than the current one
+template <typename T, typename, class... Args>
+stack_ptr<T> make_stack_ptr(arena &a, Args &&... args) {
+  return detail::make_object<T>(detail::get_state(a),
+                                std::forward<Args>(args)...);
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size, detail::default_initializer{});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size,
+                            const std::remove_extent_t<T> &value) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size,
+      detail::fill_initializer<std::remove_extent_t<T>>{value});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, padded_t) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size, detail::default_initializer{},
+      tail_padding);
+}
+template <typename T, typename, typename It, typename>
+stack_ptr<T> make_stack_ptr(arena &a, It first, It last) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), std::distance(first, last),
+      detail::range_initializer<It>{first, false});
+}
+template <typename T, typename, typename Gen, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, Gen gen) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size, detail::generator_initializer<Gen>{gen});
+}
+template <typename T, typename, typename It, typename>
+stack_ptr<T> make_stack_ptr(arena &a, It first, It last, streaming_t) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), std::distance(first, last),
+      detail::range_initializer<It>{first, true});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr_for_overwrite(arena &a, std::size_t size) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size, detail::default_initializer{});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr_zeroed(arena &a, std::size_t size) {
+  auto state = detail::get_state(a);
+  return detail::make_array<std::remove_extent_t<T>>(
+      state, size, detail::value_initializer{state});
+}
+
+// Parallel overloads, which split initialization across par's executor. The
+// calling thread waits for every chunk, and generators are called from several
+// threads at once
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(std::size_t size, const parallel_t &par) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size,
+      detail::parallel_initializer<detail::default_initializer>{par, {}});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, const parallel_t &par) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size,
+      detail::parallel_initializer<detail::default_initializer>{par, {}});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(std::size_t size,
+                            const std::remove_extent_t<T> &value,
+                            const parallel_t &par) {
+  using init = detail::fill_initializer<std::remove_extent_t<T>>;
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size,
+      detail::parallel_initializer<init>{par, init{value}});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size,
+                            const std::remove_extent_t<T> &value,
+                            const parallel_t &par) {
+  using init = detail::fill_initializer<std::remove_extent_t<T>>;
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size,
+      detail::parallel_initializer<init>{par, init{value}});
+}
+template <typename T, typename, typename Gen, typename>
+stack_ptr<T> make_stack_ptr(std::size_t size, Gen gen, const parallel_t &par) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::current_arena(), size,
+      detail::parallel_initializer<Gen>{par, std::move(gen)});
+}
+template <typename T, typename, typename Gen, typename>
+stack_ptr<T> make_stack_ptr(arena &a, std::size_t size, Gen gen,
+                            const parallel_t &par) {
+  return detail::make_array<std::remove_extent_t<T>>(
+      detail::get_state(a), size,
+      detail::parallel_initializer<Gen>{par, std::move(gen)});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr_zeroed(std::size_t size, const parallel_t &par) {
+  auto state = detail::current_arena();
+  return detail::make_array<std::remove_extent_t<T>>(
+      state, size,
+      detail::parallel_initializer<detail::value_initializer>{par, {state}});
+}
+template <typename T, typename>
+stack_ptr<T> make_stack_ptr_zeroed(arena &a, std::size_t size,
+                                   const parallel_t &par) {
+  auto state = detail::get_state(a);
+  return detail::make_array<std::remove_extent_t<T>>(
+      state, size,
+      detail::parallel_initializer<detail::value_initializer>{par, {state}});
 }
 
 } // namespace stackalloc
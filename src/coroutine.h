@@ -0,0 +1,39 @@
+#pragma once
+
+#include "allocate.h"
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+namespace stackalloc {
+
+// A base for coroutine promise types that places coroutine frames in the
+// current arena instead of on the heap.
+// Nested co_await chains release their frames in (mostly) LIFO order, which
+// keeps them at the top of the arena. A frame that outlives the frames and
+// stack_ptrs allocated after it is still released correctly: its memory is
+// reclaimed once everything above it has been released.
+// Each frame remembers its arena, so it may be destroyed after being resumed
+// on another thread or while a different arena is current.
+struct coroutine_frame_allocator {
+  static void *operator new(std::size_t size) {
+    auto state = detail::current_arena();
+    auto p = detail::allocate(state, header_size + size);
+    *reinterpret_cast<detail::arena_state **>(p) = state;
+    return p + header_size;
+  }
+
+  static void operator delete(void *frame, std::size_t size) {
+    auto p = static_cast<char *>(frame) - header_size;
+    detail::deallocate(*reinterpret_cast<detail::arena_state **>(p), p,
+                       header_size + size);
+  }
+
+private:
+  // Space in front of the frame for its arena, which keeps the frame aligned
+  // for any fundamental type
+  static constexpr std::size_t header_size = alignof(std::max_align_t);
+};
+
+} // namespace stackalloc
+
+#endif
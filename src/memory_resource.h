@@ -0,0 +1,56 @@
+#pragma once
+
+#include "allocate.h"
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+
+namespace stackalloc {
+
+// A std::pmr::memory_resource serving allocations from an arena, so that
+// libraries written against pmr allocators can use the stack allocator.
+// Deallocation follows the same rules as stackalloc::allocator: memory released
+// out of LIFO order is reclaimed once everything allocated after it is gone.
+// It also works as the upstream of a std::pmr::monotonic_buffer_resource,
+// which then carves its small allocations out of arena chunks
+class stack_resource : public std::pmr::memory_resource {
+  detail::arena_state *a;
+
+public:
+  // Allocates from the current arena
+  stack_resource() noexcept : a(detail::current_arena()) {}
+  // Allocates from an explicit arena
+  explicit stack_resource(arena &ar) noexcept : a(detail::get_state(ar)) {}
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    if (alignment <= detail::allocation_alignment())
+      return detail::allocate(a, bytes);
+    // Over-align within a larger allocation, recording how far the result is
+    // from the start of the allocation just in front of it
+    auto p = detail::allocate(a, bytes + alignment);
+    auto offset = alignment - reinterpret_cast<std::uintptr_t>(p) % alignment;
+    std::memcpy(p + offset - sizeof offset, &offset, sizeof offset);
+    return p + offset;
+  }
+
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    auto c = static_cast<char *>(p);
+    if (alignment <= detail::allocation_alignment()) {
+      detail::deallocate(a, c, bytes);
+      return;
+    }
+    std::size_t offset;
+    std::memcpy(&offset, c - sizeof offset, sizeof offset);
+    detail::deallocate(a, c - offset, bytes + alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    auto r = dynamic_cast<const stack_resource *>(&other);
+    return r && r->a == a;
+  }
+};
+
+} // namespace stackalloc
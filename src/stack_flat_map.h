@@ -0,0 +1,427 @@
+#pragma once
+
+#include "allocate.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace stackalloc {
+
+namespace detail {
+// A group of control bytes in a flat map, probed together. Each control byte
+// is either empty, deleted, or holds 7 bits of the hash of a full slot
+class control_group {
+public:
+  static constexpr std::size_t size = 16;
+  static constexpr std::int8_t empty = -128;
+  static constexpr std::int8_t deleted = -2;
+
+private:
+#if defined(__SSE2__)
+  __m128i ctrl;
+
+public:
+  explicit control_group(const std::int8_t *p)
+      : ctrl(_mm_load_si128(reinterpret_cast<const __m128i *>(p))) {}
+
+  // Returns a bit mask of the slots whose control byte is h
+  std::uint32_t match(std::int8_t h) const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), ctrl));
+  }
+  // Returns a bit mask of the slots that are empty or deleted
+  std::uint32_t match_free() const { return _mm_movemask_epi8(ctrl); }
+#else
+  std::int8_t ctrl[size];
+
+public:
+  explicit control_group(const std::int8_t *p) { std::memcpy(ctrl, p, size); }
+
+  std::uint32_t match(std::int8_t h) const {
+    std::uint32_t mask = 0;
+    for (std::size_t i = 0; i < size; ++i)
+      mask |= std::uint32_t(ctrl[i] == h) << i;
+    return mask;
+  }
+  std::uint32_t match_free() const {
+    std::uint32_t mask = 0;
+    for (std::size_t i = 0; i < size; ++i)
+      mask |= std::uint32_t(ctrl[i] < 0) << i;
+    return mask;
+  }
+#endif
+  std::uint32_t match_empty() const { return match(empty); }
+};
+
+// Returns the index of the lowest set bit of a non-zero mask
+inline std::size_t lowest_bit(std::uint32_t mask) {
+#if defined(__GNUC__)
+  return __builtin_ctz(mask);
+#else
+  std::size_t i = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++i;
+  }
+  return i;
+#endif
+}
+} // namespace detail
+
+// An open-addressing hash map stored in a single arena allocation, for lookup
+// tables that are built and discarded within one scope.
+// Control bytes and slots share one cache line aligned allocation, and lookups
+// compare a whole group of control bytes at once with SIMD where available.
+// When the table fills up it is rehashed into a new allocation at the top of
+// the arena; the old one is reclaimed once the map is destroyed.
+// Elements are stored as std::pair<K, V>, whose keys must not be modified
+// through iterators. A stack_flat_map should be destroyed in the scope it was
+// created in. Unlike stack_ptr it can't be moved out of that scope either,
+// since each rehash leaves the old table behind until the map is destroyed
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class stack_flat_map {
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+
+  template <bool Const> class basic_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<K, V>;
+    using difference_type = std::ptrdiff_t;
+    using pointer =
+        std::conditional_t<Const, const value_type *, value_type *>;
+    using reference = std::remove_pointer_t<pointer> &;
+
+  private:
+    friend class stack_flat_map;
+    using slot_pointer = pointer;
+
+    const std::int8_t *ctrl;
+    slot_pointer slots;
+    size_type i;
+    size_type cap;
+
+    basic_iterator(const std::int8_t *ctrl, slot_pointer slots, size_type i,
+                   size_type cap)
+        : ctrl(ctrl), slots(slots), i(i), cap(cap) {}
+
+    void skip_free() {
+      while (i < cap && ctrl[i] < 0)
+        ++i;
+    }
+
+  public:
+    basic_iterator() : ctrl(nullptr), slots(nullptr), i(0), cap(0) {}
+    operator basic_iterator<true>() const { return {ctrl, slots, i, cap}; }
+
+    reference operator*() const { return slots[i]; }
+    pointer operator->() const { return slots + i; }
+    basic_iterator &operator++() {
+      ++i;
+      skip_free();
+      return *this;
+    }
+    basic_iterator operator++(int) {
+      auto it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const basic_iterator &other) const {
+      return i == other.i;
+    }
+    bool operator!=(const basic_iterator &other) const {
+      return i != other.i;
+    }
+  };
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+
+private:
+  using group = detail::control_group;
+  static constexpr size_type npos = size_type(-1);
+
+  // The arena the table comes from
+  detail::arena_state *a;
+  std::int8_t *ctrl = nullptr;
+  value_type *slots = nullptr;
+  // The number of slots, either 0 or a power of two multiple of the group size
+  size_type cap = 0;
+  size_type s = 0;
+  // The number of empty slots that can be filled before rehashing
+  size_type growth_left = 0;
+  Hash hash;
+  KeyEqual eq;
+
+  explicit stack_flat_map(detail::arena_state *a) : a(a) {}
+
+  static size_type slots_offset(size_type cap) {
+    return (cap + alignof(value_type) - 1) / alignof(value_type) *
+           alignof(value_type);
+  }
+  static size_type table_size(size_type cap) {
+    return slots_offset(cap) + sizeof(value_type) * cap;
+  }
+  // Tables are kept at most 7/8 full
+  static size_type max_load(size_type cap) { return cap - cap / 8; }
+
+  // Spreads the bits of the hash, so that weak hashes (like the identity hash
+  // for integers) still probe well
+  std::uint64_t hash_of(const K &key) const {
+    std::uint64_t h = hash(key) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+  }
+  static std::int8_t h2(std::uint64_t h) { return std::int8_t(h & 0x7F); }
+
+  // Visits groups in the probe sequence for h until f returns a slot index
+  template <typename F> size_type probe(std::uint64_t h, F &&f) const {
+    auto mask = cap / group::size - 1;
+    auto g = (h >> 7) & mask;
+    for (size_type step = 1;; ++step) {
+      auto found = f(g * group::size, group(ctrl + g * group::size));
+      if (found != npos)
+        return found;
+      g = (g + step) & mask;
+    }
+  }
+
+  size_type find_index(const K &key) const {
+    if (!cap)
+      return npos;
+    auto h = hash_of(key);
+    return probe(h, [&](size_type first, const group &grp) {
+      for (auto m = grp.match(h2(h)); m; m &= m - 1) {
+        auto i = first + detail::lowest_bit(m);
+        if (eq(slots[i].first, key))
+          return i;
+      }
+      // An empty slot ends the probe sequence; use cap to mean not found
+      return grp.match_empty() ? cap : npos;
+    });
+  }
+
+  // Finds the first empty or deleted slot for a key with hash h
+  size_type find_free(std::uint64_t h) const {
+    return probe(h, [&](size_type first, const group &grp) {
+      auto m = grp.match_free();
+      return m ? first + detail::lowest_bit(m) : npos;
+    });
+  }
+
+  // Moves every element into a new table of new_cap slots at the top of the
+  // arena, then releases the old table
+  void rehash(size_type new_cap) {
+    auto table = detail::allocate(a, table_size(new_cap));
+    auto new_ctrl = reinterpret_cast<std::int8_t *>(table);
+    auto new_slots =
+        reinterpret_cast<value_type *>(table + slots_offset(new_cap));
+    std::memset(new_ctrl, group::empty, new_cap);
+
+    auto old_ctrl = std::exchange(ctrl, new_ctrl);
+    auto old_slots = slots;
+    auto old_cap = std::exchange(cap, new_cap);
+    if (!old_cap) {
+      slots = new_slots;
+      growth_left = max_load(cap);
+      return;
+    }
+
+    // Hashing can throw, so every element is given its new slot before any
+    // of them is moved
+    auto dest_bytes = sizeof(size_type) * old_cap;
+    size_type *dest = nullptr;
+    try {
+      dest = reinterpret_cast<size_type *>(detail::allocate(a, dest_bytes));
+      for (size_type i = 0; i < old_cap; ++i) {
+        if (old_ctrl[i] < 0)
+          continue;
+        auto h = hash_of(old_slots[i].first);
+        dest[i] = find_free(h);
+        ctrl[dest[i]] = h2(h);
+      }
+    } catch (...) {
+      if (dest)
+        detail::deallocate(a, reinterpret_cast<char *>(dest), dest_bytes);
+      detail::deallocate(a, table, table_size(new_cap));
+      ctrl = old_ctrl;
+      cap = old_cap;
+      throw;
+    }
+
+    size_type i = 0;
+    try {
+      for (; i < old_cap; ++i)
+        if (old_ctrl[i] >= 0)
+          new (new_slots + dest[i])
+              value_type(std::move_if_noexcept(old_slots[i]));
+    } catch (...) {
+      // Go back to the old table, which is intact unless its elements could
+      // only be moved and moving one threw
+      if constexpr (!std::is_trivially_destructible_v<value_type>)
+        for (size_type k = 0; k < i; ++k)
+          if (old_ctrl[k] >= 0)
+            new_slots[dest[k]].~value_type();
+      detail::deallocate(a, reinterpret_cast<char *>(dest), dest_bytes);
+      detail::deallocate(a, table, table_size(new_cap));
+      ctrl = old_ctrl;
+      cap = old_cap;
+      throw;
+    }
+    detail::deallocate(a, reinterpret_cast<char *>(dest), dest_bytes);
+
+    slots = new_slots;
+    if constexpr (!std::is_trivially_destructible_v<value_type>)
+      for (size_type k = 0; k < old_cap; ++k)
+        if (old_ctrl[k] >= 0)
+          old_slots[k].~value_type();
+    detail::deallocate(a, reinterpret_cast<char *>(old_ctrl),
+                       table_size(old_cap));
+    growth_left = max_load(cap) - s;
+  }
+
+  void destroy_all() {
+    if constexpr (!std::is_trivially_destructible_v<value_type>)
+      for (size_type i = 0; i < cap; ++i)
+        if (ctrl[i] >= 0)
+          slots[i].~value_type();
+  }
+
+  iterator make_iterator(size_type i) { return {ctrl, slots, i, cap}; }
+  const_iterator make_iterator(size_type i) const {
+    return {ctrl, slots, i, cap};
+  }
+
+public:
+  // Creates an empty map in the current arena
+  stack_flat_map() : stack_flat_map(detail::current_arena()) {}
+  // Creates an empty map in an explicit arena
+  explicit stack_flat_map(arena &ar) : stack_flat_map(detail::get_state(ar)) {}
+  stack_flat_map(const stack_flat_map &) = delete;
+  stack_flat_map &operator=(const stack_flat_map &) = delete;
+  stack_flat_map(stack_flat_map &&) = delete;
+  stack_flat_map &operator=(stack_flat_map &&) = delete;
+
+  ~stack_flat_map() {
+    if (cap) {
+      destroy_all();
+      detail::deallocate(a, reinterpret_cast<char *>(ctrl), table_size(cap));
+    }
+  }
+
+  // Iterators:
+  iterator begin() {
+    auto it = make_iterator(0);
+    it.skip_free();
+    return it;
+  }
+  const_iterator begin() const {
+    auto it = make_iterator(0);
+    it.skip_free();
+    return it;
+  }
+  iterator end() { return make_iterator(cap); }
+  const_iterator end() const { return make_iterator(cap); }
+
+  // Capacity:
+  bool empty() const noexcept { return s == 0; }
+  size_type size() const noexcept { return s; }
+  size_type capacity() const noexcept { return cap; }
+
+  // Makes room for n elements without rehashing
+  void reserve(size_type n) {
+    auto new_cap = cap ? cap : group::size;
+    while (max_load(new_cap) < n)
+      new_cap *= 2;
+    if (new_cap > cap)
+      rehash(new_cap);
+  }
+
+  // Lookup:
+  iterator find(const K &key) {
+    auto i = find_index(key);
+    return make_iterator(i == npos ? cap : i);
+  }
+  const_iterator find(const K &key) const {
+    auto i = find_index(key);
+    return make_iterator(i == npos ? cap : i);
+  }
+  bool contains(const K &key) const { return find(key) != end(); }
+  size_type count(const K &key) const { return contains(key); }
+
+  V &at(const K &key) {
+    auto it = find(key);
+    if (it == end())
+      throw std::out_of_range("stack_flat_map::at");
+    return it->second;
+  }
+  const V &at(const K &key) const {
+    auto it = find(key);
+    if (it == end())
+      throw std::out_of_range("stack_flat_map::at");
+    return it->second;
+  }
+
+  // Modifiers:
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const K &key, Args &&... args) {
+    auto i = find_index(key);
+    if (i != npos && i != cap)
+      return {make_iterator(i), false};
+
+    if (!growth_left) {
+      // Grow unless most of the used slots are only tombstones
+      auto tombstones = cap && s < max_load(cap) / 2;
+      rehash(tombstones ? cap : std::max(cap * 2, group::size));
+    }
+    auto h = hash_of(key);
+    i = find_free(h);
+    new (slots + i)
+        value_type(std::piecewise_construct, std::forward_as_tuple(key),
+                   std::forward_as_tuple(std::forward<Args>(args)...));
+    if (ctrl[i] == group::empty)
+      --growth_left;
+    ctrl[i] = h2(h);
+    ++s;
+    return {make_iterator(i), true};
+  }
+
+  std::pair<iterator, bool> insert(const value_type &value) {
+    return try_emplace(value.first, value.second);
+  }
+
+  V &operator[](const K &key) { return try_emplace(key).first->second; }
+
+  size_type erase(const K &key) {
+    auto i = find_index(key);
+    if (i == npos || i == cap)
+      return 0;
+    slots[i].~value_type();
+    ctrl[i] = group::deleted;
+    --s;
+    return 1;
+  }
+
+  void clear() {
+    destroy_all();
+    if (cap)
+      std::memset(ctrl, group::empty, cap);
+    s = 0;
+    growth_left = cap ? max_load(cap) : 0;
+  }
+};
+
+} // namespace stackalloc
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "allocate.h"
+
+namespace stackalloc {
+
+template <typename Header, typename Elem> class stack_ptr_with_tail;
+
+namespace detail {
+template <typename Header, typename Elem, class... Args>
+stack_ptr_with_tail<Header, Elem> make_with_tail(arena_state *state,
+                                                 std::size_t size,
+                                                 Args &&... args);
+} // namespace detail
+
+// A header object followed by a trailing array of elements, in a single
+// allocation. The header and the first elements share a cache line, so a
+// record and its payload are touched together.
+// Like stack_ptr, it deallocates itself at the end of its scope and can be
+// moved out of the function that made it, but not copied or assigned
+template <typename Header, typename Elem> class stack_ptr_with_tail {
+public:
+  using pointer = Header *;
+  using element_type = Header;
+  using tail_pointer = Elem *;
+
+private:
+  // The header, at the start of the allocation
+  pointer p;
+
+  // The number of elements in the tail
+  std::size_t s;
+
+  // The arena the allocation belongs to
+  detail::arena_state *a;
+
+  stack_ptr_with_tail(pointer p, std::size_t s, detail::arena_state *a)
+      : p(p), s(s), a(a) {}
+
+  template <typename H, typename E, class... Args>
+  friend stack_ptr_with_tail<H, E>
+  detail::make_with_tail(detail::arena_state *, std::size_t, Args &&...);
+
+public:
+  // The offset of the tail from the start of the header
+  static constexpr std::size_t tail_offset =
+      (sizeof(Header) + alignof(Elem) - 1) / alignof(Elem) * alignof(Elem);
+
+  // The number of bytes taken by a header with size elements
+  static constexpr std::size_t allocation_size(std::size_t size) {
+    return tail_offset + sizeof(Elem) * size;
+  }
+
+  // Takes over the allocation, leaving other empty
+  stack_ptr_with_tail(stack_ptr_with_tail &&other) noexcept
+      : p(std::exchange(other.p, nullptr)), s(std::exchange(other.s, 0)),
+        a(other.a) {}
+  stack_ptr_with_tail &operator=(stack_ptr_with_tail &&other) = delete;
+  stack_ptr_with_tail(const stack_ptr_with_tail &other) = delete;
+  stack_ptr_with_tail &operator=(const stack_ptr_with_tail &other) = delete;
+
+  ~stack_ptr_with_tail() {
+    if (!p)
+      return;
+    if constexpr (!std::is_trivially_destructible_v<Elem>)
+      detail::destroy_backward(tail(), tail() + s);
+    if constexpr (!std::is_trivially_destructible_v<Header>)
+      p->~Header();
+    detail::deallocate(a, reinterpret_cast<char *>(p), allocation_size(s));
+  }
+
+  // Observers:
+
+  // Returns a pointer to the header
+  pointer get() const noexcept { return p; }
+
+  // Provides access to the header
+  Header &operator*() const { return *p; }
+  pointer operator->() const noexcept { return p; }
+
+  // Returns a pointer to the first element of the tail
+  tail_pointer tail() const noexcept {
+    return reinterpret_cast<tail_pointer>(reinterpret_cast<char *>(p) +
+                                          tail_offset);
+  }
+  // Returns the number of elements in the tail
+  std::size_t tail_size() const noexcept { return s; }
+
+  // Provides access to elements of the tail
+  Elem &operator[](std::size_t i) const { return tail()[i]; }
+
+  // Iterators over the tail:
+  tail_pointer begin() const noexcept { return tail(); }
+  tail_pointer end() const noexcept { return tail() + s; }
+};
+
+namespace detail {
+template <typename Header, typename Elem, class... Args>
+stack_ptr_with_tail<Header, Elem> make_with_tail(arena_state *state,
+                                                 std::size_t size,
+                                                 Args &&... args) {
+  using result = stack_ptr_with_tail<Header, Elem>;
+  auto bytes = result::allocation_size(size);
+  auto p = allocate(state, bytes);
+  initialize(state, p, bytes, [&] {
+    new (p) Header(std::forward<Args>(args)...);
+    try {
+      default_initializer{}(reinterpret_cast<Elem *>(p + result::tail_offset),
+                            size);
+    } catch (...) {
+      if constexpr (!std::is_trivially_destructible_v<Header>)
+        reinterpret_cast<Header *>(p)->~Header();
+      throw;
+    }
+  });
+  return {reinterpret_cast<Header *>(p), size, state};
+}
+} // namespace detail
+
+// Allocates a Header constructed from args followed by size default-initialized
+// elements, in one allocation. Trivial elements are left uninitialized
+template <typename Header, typename Elem,
+          typename = detail::enable_if_object_t<Header>,
+          typename = detail::enable_if_object_t<Elem>, class... Args>
+stack_ptr_with_tail<Header, Elem> make_stack_ptr_with_tail(std::size_t size,
+                                                           Args &&... args) {
+  return detail::make_with_tail<Header, Elem>(detail::current_arena(), size,
+                                              std::forward<Args>(args)...);
+}
+// Allocates from an explicit arena rather than the current one
+template <typename Header, typename Elem,
+          typename = detail::enable_if_object_t<Header>,
+          typename = detail::enable_if_object_t<Elem>, class... Args>
+stack_ptr_with_tail<Header, Elem>
+make_stack_ptr_with_tail(arena &a, std::size_t size, Args &&... args) {
+  return detail::make_with_tail<Header, Elem>(detail::get_state(a), size,
+                                              std::forward<Args>(args)...);
+}
+
+} // namespace stackalloc
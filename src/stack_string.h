@@ -0,0 +1,162 @@
+#pragma once
+
+#include "allocate.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <limits>
+#include <string_view>
+
+namespace stackalloc {
+
+// A string that is built in place at the top of an arena, for text that is
+// assembled and thrown away within one scope (log lines, keys, queries).
+// It grows like stack_vector: in place while it is the most recent allocation,
+// relocating otherwise. The contents are exposed as a std::string_view and are
+// not null terminated.
+// A stack_string should be destroyed in the scope it was created in. Unlike
+// stack_ptr it can't be moved out of that scope either, since it is built on
+// top of the arena and only grows in place while it stays there
+class stack_string {
+public:
+  using value_type = char;
+  using size_type = std::size_t;
+  using iterator = char *;
+  using const_iterator = const char *;
+
+private:
+  // The arena the storage comes from
+  detail::arena_state *a;
+  char *p = nullptr;
+  size_type s = 0;
+  size_type cap = 0;
+
+  explicit stack_string(detail::arena_state *a) : a(a) {}
+
+  // Makes room for n more characters, growing geometrically, and returns
+  // where they go
+  char *extend(size_type n) {
+    if (s + n > cap)
+      reserve(std::max(s + n, cap * 2));
+    return p + s;
+  }
+
+  template <typename T> void append_number(T value) {
+    if constexpr (std::is_same_v<T, bool>) {
+      append(value ? std::string_view("true") : std::string_view("false"));
+    } else if constexpr (std::is_integral_v<T>) {
+      // digits10 undercounts by one, plus room for a sign
+      constexpr size_type max_size = std::numeric_limits<T>::digits10 + 2;
+      auto first = extend(max_size);
+      s = std::to_chars(first, first + max_size, value).ptr - p;
+    } else {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+      // The shortest representation that round trips
+      constexpr size_type max_size = std::numeric_limits<T>::max_digits10 + 16;
+      auto first = extend(max_size);
+      s = std::to_chars(first, first + max_size, value).ptr - p;
+#else
+      char buffer[64];
+      auto n = std::snprintf(buffer, sizeof buffer, "%.*Lg",
+                             std::numeric_limits<T>::max_digits10,
+                             static_cast<long double>(value));
+      append(std::string_view(buffer, n));
+#endif
+    }
+  }
+
+public:
+  // Creates an empty string in the current arena
+  stack_string() : stack_string(detail::current_arena()) {}
+  // Creates an empty string in an explicit arena
+  explicit stack_string(arena &ar) : stack_string(detail::get_state(ar)) {}
+  explicit stack_string(std::string_view sv) : stack_string() { append(sv); }
+  stack_string(const stack_string &) = delete;
+  stack_string &operator=(const stack_string &) = delete;
+  stack_string(stack_string &&) = delete;
+  stack_string &operator=(stack_string &&) = delete;
+
+  ~stack_string() { detail::deallocate(a, p, cap); }
+
+  // Observers:
+  std::string_view view() const noexcept { return {p, s}; }
+  operator std::string_view() const noexcept { return view(); }
+  char *data() noexcept { return p; }
+  const char *data() const noexcept { return p; }
+  char &operator[](size_type i) { return p[i]; }
+  char operator[](size_type i) const { return p[i]; }
+
+  iterator begin() noexcept { return p; }
+  const_iterator begin() const noexcept { return p; }
+  iterator end() noexcept { return p + s; }
+  const_iterator end() const noexcept { return p + s; }
+
+  bool empty() const noexcept { return s == 0; }
+  size_type size() const noexcept { return s; }
+  size_type capacity() const noexcept { return cap; }
+
+  void reserve(size_type new_cap) {
+    if (new_cap <= cap)
+      return;
+    if (p && detail::try_resize(a, p, cap, new_cap)) {
+      cap = new_cap;
+      return;
+    }
+    auto new_p = detail::allocate(a, new_cap);
+    std::copy_n(p, s, new_p);
+    detail::deallocate(a, p, cap);
+    p = new_p;
+    cap = new_cap;
+  }
+
+  // Modifiers:
+  void clear() noexcept { s = 0; }
+
+  stack_string &append(std::string_view sv) {
+    std::copy(sv.begin(), sv.end(), extend(sv.size()));
+    s += sv.size();
+    return *this;
+  }
+  stack_string &append(size_type count, char c) {
+    std::fill_n(extend(count), count, c);
+    s += count;
+    return *this;
+  }
+  void push_back(char c) {
+    *extend(1) = c;
+    ++s;
+  }
+
+  // Appends the decimal text of a number without any intermediate buffers
+  template <typename T,
+            typename = std::enable_if_t<std::is_arithmetic_v<T> &&
+                                        !std::is_same_v<T, char>>>
+  stack_string &append(T value) {
+    append_number(value);
+    return *this;
+  }
+
+  stack_string &operator+=(std::string_view sv) { return append(sv); }
+  stack_string &operator+=(char c) {
+    push_back(c);
+    return *this;
+  }
+
+  // Stream-style appends, for building strings in one expression
+  stack_string &operator<<(std::string_view sv) { return append(sv); }
+  stack_string &operator<<(const char *str) {
+    return append(std::string_view(str));
+  }
+  stack_string &operator<<(char c) { return *this += c; }
+  template <typename T,
+            typename = std::enable_if_t<std::is_arithmetic_v<T> &&
+                                        !std::is_same_v<T, char>>>
+  stack_string &operator<<(T value) {
+    return append(value);
+  }
+};
+
+// stack_string doubles as a formatting builder
+using string_builder = stack_string;
+
+} // namespace stackalloc
@@ -0,0 +1,233 @@
+#include "catch.hpp"
+#include "stackalloc/allocator.h"
+#include "stackalloc/memory_resource.h"
+#include "stackalloc/stack_flat_map.h"
+#include "stackalloc/stack_string.h"
+#include "stackalloc/stack_vector.h"
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+TEST_CASE("stack_vector interface works", "[short]") {
+  stackalloc::stack_vector<int> v;
+  static_assert(!std::is_copy_constructible_v<decltype(v)>);
+  static_assert(!std::is_move_constructible_v<decltype(v)>);
+  REQUIRE(v.empty());
+
+  for (int i = 0; i < 1000; ++i)
+    v.push_back(i);
+  REQUIRE(v.size() == 1000);
+  REQUIRE(v.capacity() >= 1000);
+  REQUIRE(v.front() == 0);
+  REQUIRE(v.back() == 999);
+  REQUIRE(std::accumulate(v.begin(), v.end(), 0) == 999 * 1000 / 2);
+  REQUIRE(*v.rbegin() == 999);
+
+  v.pop_back();
+  REQUIRE(v.size() == 999);
+  v.resize(10);
+  REQUIRE(v.size() == 10);
+  v.resize(20, 7);
+  REQUIRE(v[19] == 7);
+  v.clear();
+  REQUIRE(v.empty());
+}
+
+TEST_CASE("stack_vector keeps its elements when it relocates", "[short]") {
+  stackalloc::stack_vector<std::string> v{"a", "b"};
+  REQUIRE(v.size() == 2);
+  v.emplace_back(3, 'c');
+  auto blocker = stackalloc::make_stack_ptr<int[]>(10);
+  for (int i = 0; i < 100; ++i)
+    v.push_back(v.front());
+  REQUIRE(v.size() == 103);
+  REQUIRE(v[1] == "b");
+  REQUIRE(v[2] == "ccc");
+  REQUIRE(v[102] == "a");
+  REQUIRE(reinterpret_cast<char *>(v.data()) >
+          reinterpret_cast<char *>(blocker.get()));
+}
+
+TEST_CASE("stack_string interface works", "[short]") {
+  stackalloc::string_builder str;
+  static_assert(!std::is_copy_constructible_v<decltype(str)>);
+  REQUIRE(str.empty());
+
+  str << "id=" << 42 << ' ' << std::string_view("ratio=") << 0.5 << " ok="
+      << true << " min=" << std::numeric_limits<long long>::min();
+  REQUIRE(str.view() ==
+          "id=42 ratio=0.5 ok=true min=-9223372036854775808");
+
+  str.clear();
+  str.append(3, 'x').append("yz");
+  str += '!';
+  REQUIRE(std::string_view(str) == "xxxyz!");
+}
+
+TEST_CASE("stack_string keeps its contents when it relocates", "[short]") {
+  stackalloc::stack_string str("start:");
+  auto blocker = stackalloc::make_stack_ptr<int[]>(10);
+  for (int i = 0; i < 1000; ++i)
+    str << i % 10;
+  REQUIRE(str.size() == 1006);
+  REQUIRE(str.view().substr(0, 9) == "start:012");
+  REQUIRE(str.view().back() == '9');
+}
+
+TEST_CASE("allocator works with standard containers", "[short]") {
+  SECTION("vector") {
+    std::vector<std::string, stackalloc::allocator<std::string>> v;
+    for (int i = 0; i < 1000; ++i)
+      v.push_back(std::to_string(i));
+    REQUIRE(v.size() == 1000);
+    REQUIRE(v[999] == "999");
+  }
+
+  SECTION("map") {
+    using alloc = stackalloc::allocator<std::pair<const int, int>>;
+    std::map<int, int, std::less<int>, alloc> m;
+    for (int i = 0; i < 1000; ++i)
+      m[(i * 7919) % 1000] = i;
+    for (int i = 0; i < 1000; i += 2)
+      m.erase(i);
+    REQUIRE(m.size() == 500);
+    REQUIRE(m.begin()->first == 1);
+  }
+
+  SECTION("list") {
+    std::list<int, stackalloc::allocator<int>> l(100, 1);
+    l.push_front(0);
+    REQUIRE(l.size() == 101);
+    REQUIRE(l.front() == 0);
+  }
+
+  SECTION("Allocator equality follows the arena") {
+    stackalloc::arena arena;
+    stackalloc::allocator<int> a, b;
+    stackalloc::allocator<long> c(arena);
+    REQUIRE(a == b);
+    REQUIRE(a != c);
+    REQUIRE(stackalloc::allocator<long>(a) == a);
+  }
+}
+
+TEST_CASE("stack_resource works with pmr containers", "[short]") {
+  stackalloc::stack_resource resource;
+
+  SECTION("Directly") {
+    std::pmr::vector<std::pmr::string> v(&resource);
+    for (int i = 0; i < 1000; ++i)
+      v.emplace_back(std::to_string(i) + " long enough to need the heap");
+    REQUIRE(v[999].substr(0, 3) == "999");
+  }
+
+  SECTION("As an upstream resource") {
+    std::pmr::monotonic_buffer_resource monotonic(&resource);
+    std::pmr::map<int, int> m(&monotonic);
+    for (int i = 0; i < 1000; ++i)
+      m[i] = i;
+    REQUIRE(m.size() == 1000);
+  }
+
+  SECTION("Over-aligned allocations") {
+    auto p = resource.allocate(100, 4096);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(p) % 4096 == 0);
+    resource.deallocate(p, 100, 4096);
+  }
+
+  SECTION("Equality follows the arena") {
+    stackalloc::arena arena;
+    stackalloc::stack_resource same, other(arena);
+    REQUIRE(resource.is_equal(same));
+    REQUIRE_FALSE(resource.is_equal(other));
+  }
+}
+
+TEST_CASE("stack_flat_map interface works", "[short]") {
+  stackalloc::stack_flat_map<int, int> m;
+  REQUIRE(m.empty());
+  REQUIRE(m.find(1) == m.end());
+
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE(m.try_emplace(i, i * 2).second);
+  REQUIRE(m.size() == 1000);
+  REQUIRE(!m.try_emplace(10, 0).second);
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE(m.at(i) == i * 2);
+  REQUIRE(!m.contains(1000));
+  REQUIRE_THROWS_AS(m.at(1000), std::out_of_range);
+
+  long long sum = 0;
+  for (auto &kv : m)
+    sum += kv.second;
+  REQUIRE(sum == 999 * 1000);
+
+  for (int i = 0; i < 1000; i += 2)
+    REQUIRE(m.erase(i) == 1);
+  REQUIRE(m.erase(0) == 0);
+  REQUIRE(m.size() == 500);
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE(m.contains(i) == (i % 2 == 1));
+
+  m[3] = 5;
+  ++m[2000];
+  REQUIRE(m.at(3) == 5);
+  REQUIRE(m.at(2000) == 1);
+  m.clear();
+  REQUIRE(m.empty());
+  REQUIRE(m.begin() == m.end());
+}
+
+TEST_CASE("stack_flat_map survives churn and rehashing", "[short]") {
+  stackalloc::stack_flat_map<std::string, int> m;
+  std::map<std::string, int> reference;
+  std::uint32_t x = 1;
+  for (int i = 0; i < 20000; ++i) {
+    x = x * 1664525 + 1013904223;
+    auto key = std::to_string(x % 512);
+    if (x & 0x10000) {
+      m[key] = i;
+      reference[key] = i;
+    } else {
+      REQUIRE(m.erase(key) == reference.erase(key));
+    }
+  }
+  REQUIRE(m.size() == reference.size());
+  for (auto &kv : reference)
+    REQUIRE(m.at(kv.first) == kv.second);
+  // Tombstones are cleaned up without growing without bound
+  REQUIRE(m.capacity() <= 2048);
+}
+
+namespace {
+// Hashes strings, throwing once a budget of calls runs out
+struct limited_hash {
+  static int calls_left;
+  std::size_t operator()(const std::string &s) const {
+    if (calls_left >= 0 && calls_left-- == 0)
+      throw std::runtime_error("hash failed");
+    return std::hash<std::string>()(s);
+  }
+};
+int limited_hash::calls_left = -1;
+} // namespace
+
+TEST_CASE("stack_flat_map is unchanged when a rehash throws", "[short]") {
+  stackalloc::stack_flat_map<std::string, std::string, limited_hash> m;
+  for (int i = 0; i < 100; ++i)
+    m[std::to_string(i)] = "a value long enough to need the heap";
+  auto capacity = m.capacity();
+
+  limited_hash::calls_left = 50;
+  REQUIRE_THROWS_AS(m.reserve(capacity * 4), std::runtime_error);
+  limited_hash::calls_left = -1;
+  REQUIRE(m.capacity() == capacity);
+  REQUIRE(m.size() == 100);
+  for (int i = 0; i < 100; ++i)
+    REQUIRE(m.at(std::to_string(i)) == "a value long enough to need the heap");
+}
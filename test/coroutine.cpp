@@ -0,0 +1,65 @@
+#include "catch.hpp"
+#include "stackalloc/coroutine.h"
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <memory>
+
+namespace {
+
+struct task {
+  struct promise_type : stackalloc::coroutine_frame_allocator {
+    int value = 0;
+    task get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_value(int v) { value = v; }
+    void unhandled_exception() { throw; }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+
+  task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+  task(task &&t) : handle(std::exchange(t.handle, nullptr)) {}
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  int get() {
+    handle.resume();
+    return handle.promise().value;
+  }
+};
+
+task add(int a, int b) { co_return a + b; }
+
+} // namespace
+
+TEST_CASE("Coroutine frames are allocated from the arena", "[short]") {
+  stackalloc::arena arena;
+  stackalloc::arena_scope scope(arena);
+  auto a = stackalloc::make_stack_ptr<int[]>(16);
+
+  auto first = add(1, 2);
+  REQUIRE(static_cast<char *>(first.handle.address()) ==
+          reinterpret_cast<char *>(a.end()) + alignof(std::max_align_t));
+
+  {
+    auto second = std::make_unique<task>(add(3, 4));
+    auto third = add(5, 6);
+    // Destroy the frames out of order
+    REQUIRE(second->get() == 7);
+    second.reset();
+    REQUIRE(third.get() == 11);
+    auto b = stackalloc::make_stack_ptr<int[]>(16);
+    REQUIRE(reinterpret_cast<char *>(b.get()) >
+            static_cast<char *>(third.handle.address()));
+  }
+
+  REQUIRE(first.get() == 3);
+}
+
+#endif
@@ -1,5 +1,18 @@
+#include "stackalloc/algorithm.h"
 #include "stackalloc/allocate.h"
+#include "stackalloc/frame.h"
+#include "stackalloc/stack_ptr_with_tail.h"
+#include "stackalloc/stack_soa.h"
 #include "catch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 struct example_class {
   int a;
@@ -11,7 +24,7 @@ struct example_class {
 TEST_CASE("Single object interface works", "[short]") {
   auto obj = stackalloc::make_stack_ptr<example_class>(2, 2.4, false);
   static_assert(!std::is_copy_constructible_v<decltype(obj)>);
-  static_assert(!std::is_move_constructible_v<decltype(obj)>);
+  static_assert(std::is_nothrow_move_constructible_v<decltype(obj)>);
   static_assert(!std::is_copy_assignable_v<decltype(obj)>);
   static_assert(!std::is_move_assignable_v<decltype(obj)>);
 
@@ -25,7 +38,7 @@ TEST_CASE("Single object interface works", "[short]") {
 TEST_CASE("Array interface works", "[short]") {
   auto obj = stackalloc::make_stack_ptr<int[]>(1000);
   static_assert(!std::is_copy_constructible_v<decltype(obj)>);
-  static_assert(!std::is_move_constructible_v<decltype(obj)>);
+  static_assert(std::is_nothrow_move_constructible_v<decltype(obj)>);
   static_assert(!std::is_copy_assignable_v<decltype(obj)>);
   static_assert(!std::is_move_assignable_v<decltype(obj)>);
 
@@ -44,3 +57,566 @@ TEST_CASE("Array interface works", "[short]") {
 
   REQUIRE(obj.get() == obj.data());
 }
+
+static stackalloc::stack_ptr<int[]> make_squares(std::size_t n) {
+  auto squares = stackalloc::make_stack_ptr<int[]>(n);
+  auto scratch = stackalloc::make_stack_ptr<int[]>(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    scratch[i] = int(i);
+    squares[i] = scratch[i] * scratch[i];
+  }
+  return squares;
+}
+
+TEST_CASE("stack_ptrs can be returned from functions", "[short]") {
+  auto squares = make_squares(100);
+  REQUIRE(squares.size() == 100);
+  REQUIRE(squares[9] == 81);
+
+  auto moved = std::move(squares);
+  REQUIRE(moved[9] == 81);
+  REQUIRE(squares.get() == nullptr);
+  REQUIRE(squares.size() == 0);
+
+  auto obj = stackalloc::make_stack_ptr<std::string>("returned");
+  auto moved_obj = std::move(obj);
+  REQUIRE(obj.get() == nullptr);
+  REQUIRE(*moved_obj == "returned");
+}
+
+struct filter {
+  virtual ~filter() = default;
+  virtual int apply(int x) const = 0;
+};
+
+struct tagged {
+  virtual ~tagged() = default;
+  char tag[24] = "tagged";
+};
+
+struct scaling_filter : tagged, filter {
+  int factor;
+  int *destroyed;
+  scaling_filter(int factor, int *destroyed)
+      : factor(factor), destroyed(destroyed) {}
+  ~scaling_filter() { ++*destroyed; }
+  int apply(int x) const override { return x * factor; }
+};
+
+struct plain_base {};
+struct plain_derived : plain_base {};
+
+TEST_CASE("stack_ptrs convert to polymorphic bases", "[short]") {
+  static_assert(std::is_constructible_v<stackalloc::stack_ptr<filter>,
+                                        stackalloc::stack_ptr<scaling_filter>>);
+  static_assert(!std::is_constructible_v<stackalloc::stack_ptr<scaling_filter>,
+                                         stackalloc::stack_ptr<filter>>);
+  static_assert(
+      !std::is_constructible_v<stackalloc::stack_ptr<plain_base>,
+                               stackalloc::stack_ptr<plain_derived>>);
+
+  int destroyed = 0;
+  {
+    stackalloc::stack_ptr<filter> f =
+        stackalloc::make_stack_ptr<scaling_filter>(3, &destroyed);
+    REQUIRE(f->apply(2) == 6);
+    stackalloc::stack_ptr<tagged> t =
+        stackalloc::make_stack_ptr<scaling_filter>(4, &destroyed);
+    REQUIRE(std::string(t->tag) == "tagged");
+  }
+  REQUIRE(destroyed == 2);
+}
+
+TEST_CASE("Arena interface works", "[short]") {
+  stackalloc::arena arena;
+  static_assert(!std::is_copy_constructible_v<stackalloc::arena>);
+  static_assert(!std::is_copy_assignable_v<stackalloc::arena>);
+
+  auto obj = stackalloc::make_stack_ptr<example_class>(arena, 2, 2.4, false);
+  REQUIRE(obj->a == 2);
+  REQUIRE(obj->b == 2.4f);
+  REQUIRE(obj->c == false);
+
+  auto arr = stackalloc::make_stack_ptr<int[]>(arena, 1000);
+  REQUIRE(arr.size() == 1000);
+  for (size_t i = 0; i < std::size(arr); ++i)
+    arr[i] = i;
+  for (size_t i = 0; i < std::size(arr); ++i)
+    REQUIRE(arr[i] == int(i));
+}
+
+TEST_CASE("Frame interface works", "[short]") {
+  stackalloc::frame frame;
+  static_assert(!std::is_copy_constructible_v<stackalloc::frame>);
+  static_assert(!std::is_copy_assignable_v<stackalloc::frame>);
+
+  auto p = static_cast<int *>(frame.allocate(sizeof(int) * 100, alignof(int)));
+  REQUIRE(p != nullptr);
+  for (int i = 0; i < 100; ++i)
+    p[i] = i;
+  auto q = frame.allocate(1, 256);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(q) % 256 == 0);
+  for (int i = 0; i < 100; ++i)
+    REQUIRE(p[i] == i);
+}
+
+TEST_CASE("Array elements are destroyed in reverse order", "[short]") {
+  static std::vector<int> order;
+  static int next = 0;
+  struct numbered {
+    int id = next++;
+    ~numbered() { order.push_back(id); }
+  };
+  auto check = [](auto &&make) {
+    order.clear();
+    next = 0;
+    make();
+    REQUIRE(order == std::vector<int>{3, 2, 1, 0});
+  };
+
+  // Like delete[]
+  check([] { auto arr = stackalloc::make_stack_ptr<numbered[]>(4); });
+  check([] {
+    auto arr = stackalloc::make_stack_ptr<numbered[]>(4);
+    arr.shrink_to(2);
+  });
+  check([] {
+    stackalloc::frame frame;
+    frame.make_array<numbered>(4);
+  });
+}
+
+TEST_CASE("Frames destroy the objects they construct", "[short]") {
+  std::vector<int> destroyed;
+  struct tracked {
+    std::vector<int> &destroyed;
+    int id;
+    std::string name;
+    ~tracked() { destroyed.push_back(id); }
+  };
+
+  {
+    stackalloc::frame frame;
+    auto a = frame.make<tracked>(tracked{destroyed, 1, "first"});
+    auto b = frame.make<int>(5);
+    auto c = frame.make_array<std::string>(3);
+    c[2] = "a string long enough to need the heap";
+    auto d = frame.make<tracked>(tracked{destroyed, 2, "second"});
+    REQUIRE(a->name == "first");
+    REQUIRE(*b == 5);
+    REQUIRE(c[0].empty());
+    REQUIRE(d->name == "second");
+    destroyed.clear();
+  }
+  REQUIRE(destroyed == std::vector<int>{2, 1});
+}
+
+namespace {
+struct counted {
+  static int constructed;
+  static int destroyed;
+  static int throw_after;
+  std::string value = "a string long enough to need the heap";
+  counted() {
+    if (throw_after >= 0 && constructed >= throw_after)
+      throw std::runtime_error("construction failed");
+    ++constructed;
+  }
+  ~counted() { ++destroyed; }
+};
+int counted::constructed = 0;
+int counted::destroyed = 0;
+int counted::throw_after = -1;
+} // namespace
+
+TEST_CASE("Objects are constructed and destroyed", "[short]") {
+  counted::constructed = counted::destroyed = 0;
+
+  SECTION("Object allocations") {
+    {
+      auto obj = stackalloc::make_stack_ptr<counted>();
+      REQUIRE(counted::constructed == 1);
+      REQUIRE(obj->value.size() > 0);
+    }
+    REQUIRE(counted::destroyed == 1);
+  }
+
+  SECTION("Array allocations") {
+    {
+      auto arr = stackalloc::make_stack_ptr<counted[]>(10);
+      REQUIRE(counted::constructed == 10);
+      for (auto &x : arr)
+        REQUIRE(x.value.size() > 0);
+    }
+    REQUIRE(counted::destroyed == 10);
+  }
+
+  SECTION("Failed construction releases everything") {
+    counted::throw_after = 5;
+    REQUIRE_THROWS(stackalloc::make_stack_ptr<counted[]>(10));
+    REQUIRE_THROWS(stackalloc::make_stack_ptr<counted>());
+    counted::throw_after = -1;
+    REQUIRE(counted::destroyed == 5);
+  }
+}
+
+TEST_CASE("Array initialization variants work", "[short]") {
+  SECTION("For overwrite") {
+    auto arr = stackalloc::make_stack_ptr_for_overwrite<int[]>(1000);
+    REQUIRE(arr.size() == 1000);
+  }
+
+  SECTION("Zeroed") {
+    auto ints = stackalloc::make_stack_ptr_zeroed<int[]>(1000);
+    for (auto x : ints)
+      REQUIRE(x == 0);
+    auto strings = stackalloc::make_stack_ptr_zeroed<std::string[]>(10);
+    for (auto &x : strings)
+      REQUIRE(x.empty());
+  }
+
+  SECTION("Filled") {
+    auto ints = stackalloc::make_stack_ptr<int[]>(1001, 7);
+    for (auto x : ints)
+      REQUIRE(x == 7);
+
+    struct rgb {
+      char r, g, b;
+    };
+    auto colors = stackalloc::make_stack_ptr<rgb[]>(1001, rgb{1, 2, 3});
+    for (auto &x : colors)
+      REQUIRE((x.r == 1 && x.g == 2 && x.b == 3));
+
+    auto strings = stackalloc::make_stack_ptr<std::string[]>(10, "filled");
+    for (auto &x : strings)
+      REQUIRE(x == "filled");
+  }
+}
+
+TEST_CASE("Arrays can be resized", "[short]") {
+  auto arr = stackalloc::make_stack_ptr<std::string[]>(3, "kept");
+
+  SECTION("In place") {
+    REQUIRE(arr.try_grow(100));
+    REQUIRE(arr.size() == 100);
+    REQUIRE(arr[2] == "kept");
+    REQUIRE(arr[99].empty());
+    arr.shrink_to(2);
+    REQUIRE(arr.size() == 2);
+    REQUIRE(arr[1] == "kept");
+  }
+
+  SECTION("Relocating") {
+    auto blocker = stackalloc::make_stack_ptr<int[]>(10);
+    REQUIRE_FALSE(arr.try_grow(100));
+    REQUIRE(arr.size() == 3);
+    arr.resize(100);
+    REQUIRE(arr.size() == 100);
+    for (std::size_t i = 0; i < 3; ++i)
+      REQUIRE(arr[i] == "kept");
+    REQUIRE(arr[99].empty());
+    arr.resize(1);
+    REQUIRE(arr.size() == 1);
+    REQUIRE(arr[0] == "kept");
+  }
+}
+
+struct record_header {
+  int id;
+  std::string name;
+  record_header(int id, std::string name) : id(id), name(std::move(name)) {}
+};
+
+TEST_CASE("Headers with trailing arrays work", "[short]") {
+  auto r = stackalloc::make_stack_ptr_with_tail<record_header, double>(
+      100, 7, "samples");
+  static_assert(std::is_nothrow_move_constructible_v<decltype(r)>);
+  static_assert(!std::is_copy_constructible_v<decltype(r)>);
+  REQUIRE(r->id == 7);
+  REQUIRE((*r).name == "samples");
+  REQUIRE(r.tail_size() == 100);
+  REQUIRE(reinterpret_cast<char *>(r.tail()) >=
+          reinterpret_cast<char *>(r.get() + 1));
+  for (std::size_t i = 0; i < r.tail_size(); ++i)
+    r[i] = i * 0.5;
+  double sum = 0;
+  for (auto x : r)
+    sum += x;
+  REQUIRE(sum == 99 * 100 / 4.0);
+
+  stackalloc::arena arena;
+  auto strings = stackalloc::make_stack_ptr_with_tail<int, std::string>(
+      arena, 3, 42);
+  REQUIRE(*strings == 42);
+  REQUIRE(strings[2].empty());
+}
+
+TEST_CASE("Struct of arrays interface works", "[short]") {
+  auto points = stackalloc::make_stack_soa<float, float, std::uint8_t>(1000);
+  static_assert(std::is_nothrow_move_constructible_v<decltype(points)>);
+  static_assert(!std::is_copy_constructible_v<decltype(points)>);
+  REQUIRE(points.size() == 1000);
+
+  auto xs = points.get<0>();
+  auto ys = points.get<1>();
+  auto flags = points.get<2>();
+  REQUIRE(xs.size() == 1000);
+  REQUIRE(flags.size() == 1000);
+  for (std::size_t i = 0; i < points.size(); ++i) {
+    xs[i] = float(i);
+    ys[i] = float(i) * 2;
+    flags[i] = std::uint8_t(i % 2);
+  }
+  for (std::size_t i = 0; i < points.size(); ++i) {
+    REQUIRE(xs[i] == float(i));
+    REQUIRE(ys[i] == float(i) * 2);
+    REQUIRE(flags[i] == i % 2);
+  }
+
+  stackalloc::arena arena;
+  auto names = stackalloc::make_stack_soa<std::string, int>(arena, 3);
+  REQUIRE(names.get<0>()[2].empty());
+  stackalloc::stack_span<const std::string> view = names.get<0>();
+  REQUIRE(view.size() == 3);
+}
+
+TEST_CASE("Padded arrays can be read past their end", "[short]") {
+  auto arr = stackalloc::make_stack_ptr<float[]>(13, stackalloc::padded);
+  REQUIRE(arr.size() == 13);
+  REQUIRE(arr.padded_size() >=
+          arr.size() + stackalloc::tail_padding / sizeof(float));
+
+  stackalloc::arena arena;
+  auto strings =
+      stackalloc::make_stack_ptr<std::string[]>(arena, 2, stackalloc::padded);
+  REQUIRE(strings[1].empty());
+
+  auto plain = stackalloc::make_stack_ptr<float[]>(13);
+  REQUIRE(plain.padded_size() >= plain.size());
+  REQUIRE(stackalloc::make_stack_ptr<float[]>(0).padded_size() == 0);
+}
+
+TEST_CASE("Aligned kernels work on stack arrays", "[short]") {
+  auto xs = stackalloc::make_stack_ptr<float[]>(1001);
+  auto ys = stackalloc::make_stack_ptr<float[]>(1001);
+  static_assert(decltype(xs.span())::alignment == stackalloc::stack_alignment);
+  REQUIRE(std::uintptr_t(xs.get()) % stackalloc::stack_alignment == 0);
+
+  stackalloc::fill(xs.span(), 2.0f);
+  REQUIRE(xs[1000] == 2.0f);
+  auto copied = stackalloc::copy(xs.span(), ys.span());
+  REQUIRE(copied.size() == 1001);
+  REQUIRE(ys[500] == 2.0f);
+
+  for (std::size_t i = 0; i < xs.size(); ++i)
+    xs[i] = float(i);
+  stackalloc::transform(xs.span(), ys.span(), [](float x) { return x * 2; });
+  REQUIRE(ys[1000] == 2000.0f);
+  stackalloc::transform(xs.span(), ys.span(), ys.span(),
+                        [](float x, float y) { return y - x; });
+  REQUIRE(ys[1000] == 1000.0f);
+
+  REQUIRE(stackalloc::reduce(xs.span()) == 1000.0f * 1001 / 2);
+  REQUIRE(stackalloc::reduce(xs.span(), 1.0, [](double x, double y) {
+            return x + y;
+          }) == 1000.0 * 1001 / 2 + 1);
+  xs[37] = -5;
+  xs[900] = 5000;
+  REQUIRE(stackalloc::min(xs.span()) == -5);
+  REQUIRE(stackalloc::max(xs.span()) == 5000);
+  REQUIRE(stackalloc::min(xs.span().subspan(38, 10)) == 38);
+  REQUIRE(stackalloc::max(xs.span().first(3)) == 2);
+
+  stackalloc::stack_span<const float, 16> weaker = xs.span();
+  REQUIRE(weaker.size() == 1001);
+  stackalloc::stack_span<float> empty;
+  REQUIRE(stackalloc::copy(empty, ys.span()).empty());
+
+  // Views can be used in constant expressions
+  static constexpr int digits[] = {1, 2, 3, 4};
+  constexpr stackalloc::stack_span<const int> digit_view(digits, 4);
+  static_assert(digit_view[2] == 3 && digit_view.first(2).back() == 2 &&
+                *digit_view.begin() == 1 && digit_view.end() - digits == 4);
+  auto strings = stackalloc::make_stack_ptr<std::string[]>(3);
+  stackalloc::fill(strings.span(), "s");
+  REQUIRE(stackalloc::reduce(strings.span()) == "sss");
+}
+
+TEST_CASE("Streaming copies produce the same arrays", "[short]") {
+  std::vector<int> source(1 << 20);
+  for (std::size_t i = 0; i < source.size(); ++i)
+    source[i] = int(i);
+
+  // Start one element in so that the source isn't aligned
+  auto arr = stackalloc::make_stack_ptr<int[]>(
+      source.data() + 1, source.data() + source.size(), stackalloc::streaming);
+  REQUIRE(arr.size() == source.size() - 1);
+  REQUIRE(std::equal(arr.begin(), arr.end(), source.begin() + 1));
+
+  // Iterators of contiguous containers take the same path in C++20
+  auto from_vector = stackalloc::make_stack_ptr<int[]>(
+      source.begin() + 1, source.end(), stackalloc::streaming);
+  REQUIRE(std::equal(from_vector.begin(), from_vector.end(),
+                     source.begin() + 1));
+
+  auto copy = stackalloc::make_stack_ptr_for_overwrite<int[]>(arr.size());
+  auto copied = stackalloc::copy_streaming(arr.span(), copy.span());
+  REQUIRE(copied.size() == arr.size());
+  REQUIRE(std::equal(copy.begin(), copy.end(), arr.begin()));
+
+  stackalloc::arena arena;
+  std::list<std::string> strings{"a", "b", "c"};
+  auto from_list = stackalloc::make_stack_ptr<std::string[]>(
+      arena, strings.begin(), strings.end(), stackalloc::streaming);
+  REQUIRE(from_list.size() == 3);
+  REQUIRE(from_list[2] == "c");
+
+  const int *none = nullptr;
+  auto empty =
+      stackalloc::make_stack_ptr<int[]>(none, none, stackalloc::streaming);
+  REQUIRE(empty.size() == 0);
+  REQUIRE(stackalloc::copy_streaming(empty.span(), copy.span()).empty());
+}
+
+namespace {
+struct no_default {
+  int value;
+  explicit no_default(int value) : value(value) {}
+};
+} // namespace
+
+TEST_CASE("Arrays can be built from ranges and generators", "[short]") {
+  std::vector<int> ints{1, 2, 3, 4, 5};
+  auto copied = stackalloc::make_stack_ptr<int[]>(ints.data(),
+                                                  ints.data() + ints.size());
+  REQUIRE(std::equal(copied.begin(), copied.end(), ints.begin(), ints.end()));
+
+  std::list<std::string> strings{"a", "b", "c"};
+  auto from_list =
+      stackalloc::make_stack_ptr<std::string[]>(strings.begin(), strings.end());
+  REQUIRE(from_list.size() == 3);
+  REQUIRE(from_list[1] == "b");
+
+  auto converted = stackalloc::make_stack_ptr<no_default[]>(ints.begin(),
+                                                            ints.end());
+  REQUIRE(converted[4].value == 5);
+
+  auto squares = stackalloc::make_stack_ptr<no_default[]>(
+      10, [](std::size_t i) { return no_default(int(i * i)); });
+  REQUIRE(squares[9].value == 81);
+
+  int next = 0;
+  stackalloc::arena arena;
+  auto counter =
+      stackalloc::make_stack_ptr<int[]>(arena, 5, [&] { return next++; });
+  REQUIRE(counter[4] == 4);
+
+  // (n, value) still fills rather than being taken for a range
+  auto filled = stackalloc::make_stack_ptr<std::size_t[]>(3, 7);
+  REQUIRE(filled[2] == 7);
+  auto empty = stackalloc::make_stack_ptr<int[]>(ints.begin(), ints.begin());
+  REQUIRE(empty.size() == 0);
+
+  counted::constructed = counted::destroyed = 0;
+  counted::throw_after = 5;
+  REQUIRE_THROWS(
+      stackalloc::make_stack_ptr<counted[]>(10, [] { return counted(); }));
+  counted::throw_after = -1;
+  REQUIRE(counted::constructed == counted::destroyed);
+}
+
+namespace {
+// Runs every task on a thread of its own, joining them at the end of the scope
+struct thread_executor {
+  std::vector<std::thread> threads;
+  std::mutex m;
+  ~thread_executor() {
+    for (auto &t : threads)
+      t.join();
+  }
+  stackalloc::parallel_t parallel(std::size_t concurrency) {
+    return stackalloc::parallel(
+        [this](std::function<void()> task) {
+          std::lock_guard<std::mutex> lock(m);
+          threads.emplace_back(std::move(task));
+        },
+        concurrency);
+  }
+};
+} // namespace
+
+TEST_CASE("Large arrays can be initialized in parallel", "[short]") {
+  thread_executor ex;
+  auto par = ex.parallel(4);
+  std::size_t n = std::size_t(4) << 20;
+
+  auto filled = stackalloc::make_stack_ptr<int[]>(n, 7, par);
+  REQUIRE(ex.threads.size() == 3);
+  REQUIRE(std::all_of(filled.begin(), filled.end(),
+                      [](int x) { return x == 7; }));
+
+  auto zeroed = stackalloc::make_stack_ptr_zeroed<int[]>(n, par);
+  REQUIRE(std::all_of(zeroed.begin(), zeroed.end(),
+                      [](int x) { return x == 0; }));
+
+  auto indices = stackalloc::make_stack_ptr<std::size_t[]>(
+      n, [](std::size_t i) { return i; }, par);
+  std::size_t mismatches = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    mismatches += indices[i] != i;
+  REQUIRE(mismatches == 0);
+
+  stackalloc::arena arena;
+  auto strings = stackalloc::make_stack_ptr<std::string[]>(arena, 100000, par);
+  REQUIRE(strings[99999].empty());
+
+  // Arrays too small to be worth splitting are initialized inline
+  auto threads = ex.threads.size();
+  auto small = stackalloc::make_stack_ptr<int[]>(1000, 1, par);
+  REQUIRE(ex.threads.size() == threads);
+  REQUIRE(small[999] == 1);
+}
+
+TEST_CASE("Parallel initialization doesn't wait for a busy executor",
+          "[short]") {
+  // Like a pool whose workers are all busy: tasks only run after the
+  // initialization has returned
+  std::vector<std::function<void()>> queued;
+  auto par = stackalloc::parallel(
+      [&](std::function<void()> task) { queued.push_back(std::move(task)); },
+      4);
+  std::size_t n = std::size_t(4) << 20;
+
+  auto filled = stackalloc::make_stack_ptr<int[]>(n, 7, par);
+  REQUIRE(queued.size() == 3);
+  REQUIRE(std::all_of(filled.begin(), filled.end(),
+                      [](int x) { return x == 7; }));
+  for (auto &task : queued)
+    task();
+
+  // Trivial default initialization has nothing to hand out
+  queued.clear();
+  auto uninitialized = stackalloc::make_stack_ptr<int[]>(n, par);
+  REQUIRE(queued.empty());
+}
+
+TEST_CASE("Failed parallel initialization destroys every chunk", "[short]") {
+  thread_executor ex;
+  std::atomic<int> alive{0};
+  struct tracked {
+    std::atomic<int> *alive;
+    char padding[60];
+    tracked(std::atomic<int> *alive, std::size_t i) : alive(alive) {
+      if (i == 100000)
+        throw std::runtime_error("construction failed");
+      ++*alive;
+    }
+    ~tracked() { --*alive; }
+  };
+  REQUIRE_THROWS_AS(stackalloc::make_stack_ptr<tracked[]>(
+                        200000,
+                        [&](std::size_t i) { return tracked(&alive, i); },
+                        ex.parallel(8)),
+                    std::runtime_error);
+  REQUIRE(alive == 0);
+}
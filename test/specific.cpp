@@ -1,6 +1,19 @@
 #include "catch.hpp"
 #include "stackalloc/allocate.h"
+#include "stackalloc/allocator.h"
+#include "stackalloc/frame.h"
+#include "stackalloc/memory_resource.h"
+#include "stackalloc/stack_flat_map.h"
+#include "stackalloc/stack_ptr_with_tail.h"
+#include "stackalloc/stack_soa.h"
+#include "stackalloc/stack_vector.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 // Figure out cache line falling back to destructive interference size if no
 // known cache line size is provided
@@ -107,3 +120,434 @@ TEST_CASE("Deep nested allocations don't throw", "[short]") {
   REQUIRE(a[0] == 9);
   REQUIRE(a[a.size() - 1] == 0);
 }
+
+TEST_CASE("Fragmented chains are compacted once the stack empties", "[short]") {
+  // Each allocation is larger than the last so the burst spans several blocks
+  // of a fresh arena
+  stackalloc::arena arena;
+  auto burst = [&](auto &&check) {
+    auto a = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size * 1000);
+    auto b = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size * 4000);
+    auto c = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size * 16000);
+    check(a, b, c);
+  };
+  burst([](auto &a, auto &b, auto &c) {
+    REQUIRE(b.begin() != a.end());
+    REQUIRE(c.begin() != b.end());
+  });
+  burst([](auto &a, auto &b, auto &c) {
+    REQUIRE(a.end() == b.begin());
+    REQUIRE(b.end() == c.begin());
+  });
+}
+
+TEST_CASE("Long block chains are released without leaking", "[short]") {
+  // Each allocation is four times the last, so each starts a new block. The
+  // first is large enough that alignment slack can't fit the second in too
+  constexpr std::size_t depth = 8;
+  auto sizes = [](std::size_t k) { return cache_line_size << (2 * k + 2); };
+
+  SECTION("Compaction frees every block but the one it keeps") {
+    stackalloc::arena arena;
+    std::vector<stackalloc::stack_ptr<char[]>> chain;
+    chain.reserve(depth);
+    auto burst = [&] {
+      for (std::size_t k = 0; k < depth; ++k)
+        chain.push_back(stackalloc::make_stack_ptr<char[]>(arena, sizes(k)));
+    };
+    auto release = [&] {
+      while (!chain.empty())
+        chain.pop_back();
+    };
+    burst();
+    std::size_t blocks = 1;
+    for (std::size_t k = 1; k < depth; ++k)
+      blocks += chain[k - 1].end() != chain[k].begin();
+    REQUIRE(blocks == depth);
+    release();
+
+    // Nothing is in use any more, and the kept block holds the peak
+    char *start;
+    {
+      auto probe = stackalloc::make_stack_ptr<char[]>(arena, 1);
+      start = probe.get();
+    }
+    burst();
+    REQUIRE(chain[0].get() == start);
+    for (std::size_t k = 1; k < depth; ++k)
+      REQUIRE(chain[k - 1].end() == chain[k].begin());
+    release();
+  }
+
+  SECTION("Destroying an arena frees a chain of thousands of blocks") {
+    // Capped blocks hold one allocation each, so the chain is far deeper than
+    // a recursive teardown could walk on a thread's stack
+    constexpr std::size_t blocks = 200000;
+    stackalloc::arena arena;
+    auto state = stackalloc::detail::get_state(arena);
+    stackalloc::detail::limit_block_size(state, cache_line_size);
+    char *previous = nullptr;
+    std::size_t starts = 0;
+    for (std::size_t k = 0; k < blocks; ++k) {
+      auto p = stackalloc::detail::allocate(state, cache_line_size);
+      starts += p != previous;
+      previous = p + cache_line_size;
+    }
+    REQUIRE(starts >= blocks / 2);
+  }
+}
+
+TEST_CASE("Arena scopes redirect allocations", "[short]") {
+  stackalloc::arena arena;
+  auto a = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size);
+  {
+    stackalloc::arena_scope scope(arena);
+    auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    REQUIRE(a.end() == b.begin());
+  }
+  auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() != c.begin());
+}
+
+TEST_CASE("Arenas can move between threads", "[short]") {
+  stackalloc::arena arena;
+  auto a = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size);
+  bool abutted = false;
+  std::thread([&] {
+    stackalloc::arena_scope scope(arena);
+    { auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size); }
+    auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    abutted = a.end() == c.begin();
+  }).join();
+  REQUIRE(abutted);
+  auto d = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size);
+  REQUIRE(a.end() == d.begin());
+}
+
+TEST_CASE("Out of order deallocations are deferred", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    // Keep b on the heap so that it can be released before c
+    std::unique_ptr<stackalloc::stack_ptr<int[]>> b(
+        new auto(stackalloc::make_stack_ptr<int[]>(cache_line_size)));
+    auto b_begin = b->begin();
+    REQUIRE(a.end() == b_begin);
+    {
+      auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+      b.reset();
+      auto d = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+      REQUIRE(c.end() == d.begin());
+    }
+    // Releasing c reclaims b's memory as well
+    auto e = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    REQUIRE(e.begin() == b_begin);
+  }
+}
+
+TEST_CASE("Contexts can be exchanged between fibers", "[short]") {
+  stackalloc::arena first_fiber, second_fiber;
+  auto original = stackalloc::exchange_context(stackalloc::context(first_fiber));
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  auto first_context =
+      stackalloc::exchange_context(stackalloc::context(second_fiber));
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  auto second_context = stackalloc::exchange_context(first_context);
+  auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == c.begin());
+  stackalloc::exchange_context(second_context);
+  auto d = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(b.end() == d.begin());
+  stackalloc::exchange_context(original);
+}
+
+TEST_CASE("Frames release everything allocated inside them", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    stackalloc::frame frame;
+    // Small allocations are packed rather than rounded to cache lines
+    auto first = static_cast<char *>(frame.allocate(8, 8));
+    auto second = static_cast<char *>(frame.allocate(8, 8));
+    REQUIRE(first == reinterpret_cast<char *>(a.end()));
+    REQUIRE(second == first + 8);
+    // Force the frame to span several blocks
+    for (int i = 0; i < 8; ++i)
+      frame.allocate(cache_line_size * 1000 << i);
+    auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  }
+  auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == c.begin());
+}
+
+TEST_CASE("Frames keep their block when older allocations are released",
+          "[short]") {
+  stackalloc::arena arena;
+  auto w = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size, 7);
+  auto x = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size);
+  // Leave an empty block on top of the chain
+  int *big_start;
+  {
+    auto big = stackalloc::make_stack_ptr<char[]>(arena, std::size_t(1) << 20);
+    big_start = reinterpret_cast<int *>(big.get());
+  }
+  {
+    stackalloc::frame frame(arena);
+    // Releasing x mustn't drop the block the frame was opened in
+    { auto moved = std::move(x); }
+    frame.allocate(128);
+  }
+  REQUIRE(w[0] == 7);
+  auto y = stackalloc::make_stack_ptr<int[]>(arena, cache_line_size);
+  REQUIRE(y.get() == big_start);
+}
+
+TEST_CASE("Failed construction releases its memory", "[short]") {
+  struct throwing {
+    throwing() { throw std::runtime_error("construction failed"); }
+  };
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE_THROWS(stackalloc::make_stack_ptr<throwing>());
+  REQUIRE_THROWS(stackalloc::make_stack_ptr<throwing[]>(10));
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+TEST_CASE("Large fills overwrite reused memory", "[short]") {
+  // Larger than any L2 cache so the streaming path is taken
+  constexpr std::size_t size = std::size_t(1) << 23;
+  int *first;
+  {
+    auto dirty = stackalloc::make_stack_ptr<int[]>(size, -1);
+    first = dirty.get();
+  }
+  {
+    auto zeroed = stackalloc::make_stack_ptr_zeroed<int[]>(size);
+    REQUIRE(zeroed.get() == first);
+    REQUIRE(std::all_of(zeroed.begin(), zeroed.end(),
+                        [](int x) { return x == 0; }));
+  }
+  auto filled = stackalloc::make_stack_ptr<short[]>(size + 3, 5);
+  REQUIRE(reinterpret_cast<int *>(filled.get()) == first);
+  REQUIRE(std::all_of(filled.begin(), filled.end(),
+                      [](short x) { return x == 5; }));
+}
+
+TEST_CASE("Zeroing only skips memory that was never handed out", "[short]") {
+  constexpr std::size_t size = std::size_t(1) << 18;
+  stackalloc::arena arena;
+  int *first;
+  {
+    auto dirty = stackalloc::make_stack_ptr<int[]>(arena, size, -1);
+    first = dirty.get();
+  }
+  // Half of this overlaps the dirty allocation, the rest is untouched
+  auto state = stackalloc::detail::get_state(arena);
+  auto bytes = sizeof(int) * size * 2;
+  auto p = stackalloc::detail::allocate(state, bytes);
+  REQUIRE(p == reinterpret_cast<char *>(first));
+  auto dirty = stackalloc::detail::dirty_size(state, p, bytes);
+#if defined(__unix__) || defined(__APPLE__)
+  // The block is mapped from the kernel, so only the first half needs clearing
+  REQUIRE(dirty == bytes / 2);
+#else
+  REQUIRE(dirty == bytes);
+#endif
+  // Only the latest allocation knows where its clean memory starts
+  auto q = stackalloc::detail::allocate(state, 1);
+  REQUIRE(stackalloc::detail::dirty_size(state, p, bytes) == bytes);
+  stackalloc::detail::deallocate(state, q, 1);
+  stackalloc::detail::deallocate(state, p, bytes);
+
+  auto zeroed = stackalloc::make_stack_ptr_zeroed<int[]>(arena, size * 2);
+  REQUIRE(zeroed.get() == first);
+  REQUIRE(std::all_of(zeroed.begin(), zeroed.end(),
+                      [](int x) { return x == 0; }));
+}
+
+TEST_CASE("Resizing keeps the stack compact", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    REQUIRE(b.try_grow(cache_line_size * 2));
+    auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    REQUIRE(b.end() == c.begin());
+    b.shrink_to(cache_line_size);
+    // b is no longer on top, so it has to relocate above c
+    b.resize(cache_line_size * 3);
+    REQUIRE(b.begin() == c.end());
+  }
+  // Everything b and c used is reclaimed
+  auto d = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == d.begin());
+}
+
+TEST_CASE("stack_vector grows in place while on top", "[short]") {
+  // first force a gigantic allocation to give ourselves lots of free space
+  { auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size * 10000); }
+  stackalloc::stack_vector<int> v;
+  v.push_back(0);
+  auto first = v.data();
+  for (int i = 1; i < 10000; ++i)
+    v.push_back(i);
+  REQUIRE(v.data() == first);
+}
+
+TEST_CASE("Containers release everything through the allocator", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    std::vector<int, stackalloc::allocator<int>> v;
+    std::map<int, int, std::less<int>,
+             stackalloc::allocator<std::pair<const int, int>>>
+        m;
+    for (int i = 0; i < 10000; ++i) {
+      v.push_back(i);
+      m[(i * 7919) % 10000] = i;
+    }
+  }
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+TEST_CASE("Node containers tear down in any order", "[short]") {
+  // Grow the stack first, so that every node comes from one block
+  { auto a = stackalloc::make_stack_ptr<char[]>(std::size_t(16) << 20); }
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    // Keys arrive scrambled, so nodes are freed far out of address order
+    std::map<int, int, std::less<int>,
+             stackalloc::allocator<std::pair<const int, int>>>
+        m;
+    for (int i = 0; i < 100000; ++i)
+      m[(i * 7919) % 100000] = i;
+    for (int i = 0; i < 100000; i += 3)
+      m.erase(i);
+    REQUIRE(m.size() == 66666);
+  }
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+TEST_CASE("Monotonic buffers release everything upstream", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    stackalloc::stack_resource resource;
+    std::pmr::monotonic_buffer_resource monotonic(&resource);
+    std::pmr::vector<int> v(&monotonic);
+    for (int i = 0; i < 10000; ++i)
+      v.push_back(i);
+    auto over_aligned = resource.allocate(100, 4096);
+    resource.deallocate(over_aligned, 100, 4096);
+  }
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+TEST_CASE("stack_flat_map releases every table it rehashed from", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    stackalloc::stack_flat_map<int, double> m;
+    m.reserve(100);
+    REQUIRE(m.capacity() >= 128);
+    for (int i = 0; i < 10000; ++i)
+      m[i] = i;
+    REQUIRE(m.capacity() >= 10000);
+  }
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+static stackalloc::stack_ptr<int[]> make_with_scratch() {
+  auto result = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  auto scratch = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  std::fill(scratch.begin(), scratch.end(), 1);
+  std::copy(scratch.begin(), scratch.end(), result.begin());
+  return result;
+}
+
+TEST_CASE("Returned stack_ptrs keep their place on the stack", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    auto b = make_with_scratch();
+    REQUIRE(a.end() == b.begin());
+    // The scratch buffer above b was released when the function returned
+    auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    REQUIRE(b.end() == c.begin());
+  }
+  auto d = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == d.begin());
+}
+
+struct shape {
+  virtual ~shape() = default;
+};
+struct padding {
+  virtual ~padding() = default;
+  char bytes[cache_line_size];
+};
+// shape is not at the start of a big_shape, and a big_shape spans several
+// cache lines
+struct big_shape : padding, shape {
+  char more[cache_line_size * 2];
+};
+
+TEST_CASE("Polymorphic stack_ptrs release the whole object", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    stackalloc::stack_ptr<shape> s = stackalloc::make_stack_ptr<big_shape>();
+    REQUIRE(reinterpret_cast<char *>(s.get()) !=
+            reinterpret_cast<char *>(a.end()));
+  }
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+TEST_CASE("Trailing arrays share the header's allocation", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    struct header {
+      short count;
+    };
+    auto r = stackalloc::make_stack_ptr_with_tail<header, int>(
+        cache_line_size, header{5});
+    REQUIRE(reinterpret_cast<char *>(r.get()) ==
+            reinterpret_cast<char *>(a.end()));
+    REQUIRE(reinterpret_cast<char *>(r.tail()) ==
+            reinterpret_cast<char *>(r.get()) + sizeof(int));
+    auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+    // The header only costs the tail one extra cache line, rather than a
+    // separate allocation
+    REQUIRE(reinterpret_cast<char *>(b.begin()) ==
+            reinterpret_cast<char *>(a.end() + cache_line_size) +
+                cache_line_size);
+  }
+  auto c = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == c.begin());
+}
+
+TEST_CASE("Struct of arrays columns are padded to cache lines", "[short]") {
+  auto a = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  {
+    auto soa = stackalloc::make_stack_soa<double, char, int>(10);
+    auto first = reinterpret_cast<char *>(soa.get<0>().data());
+    auto second = soa.get<1>().data();
+    auto third = reinterpret_cast<char *>(soa.get<2>().data());
+    REQUIRE(first == reinterpret_cast<char *>(a.end()));
+    REQUIRE(second == first + (10 * sizeof(double) + cache_line_size - 1) /
+                                  cache_line_size * cache_line_size);
+    REQUIRE(third == second + cache_line_size);
+    REQUIRE(std::uintptr_t(third) % cache_line_size == 0);
+  }
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(a.end() == b.begin());
+}
+
+TEST_CASE("Padded arrays keep their slack when resized", "[short]") {
+  auto a =
+      stackalloc::make_stack_ptr<int[]>(cache_line_size, stackalloc::padded);
+  REQUIRE(a.padded_size() == a.size() + cache_line_size / sizeof(int));
+  a.resize(cache_line_size * 2);
+  REQUIRE(a.padded_size() >=
+          a.size() + stackalloc::tail_padding / sizeof(int));
+  auto b = stackalloc::make_stack_ptr<int[]>(cache_line_size);
+  REQUIRE(reinterpret_cast<char *>(b.begin()) >=
+          reinterpret_cast<char *>(a.end()) + stackalloc::tail_padding);
+}